@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <signal.h>
 #include <sys/types.h>
@@ -9,6 +10,13 @@
 #include <pthread.h>
 #include <stdatomic.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <execinfo.h>
+#include <link.h>
 
 ///////////////////////////////////////////////////////////////////////
 // CONFIGURATION
@@ -37,6 +45,20 @@
 #  define SPEW_LEVEL_ENV "SPEW_LEVEL"
 #endif
 
+#ifndef ASSERT_TIER_ENV
+// Comment this line out to not use at compile time or to set using a
+// compiler command line option like:
+// -DASSERT_TIER_ENV=ASSERT_TIER
+#  define ASSERT_TIER_ENV "ASSERT_TIER"
+#endif
+
+#ifndef ASSERT_SAMPLE_ENV
+// Comment this line out to not use at compile time or to set using a
+// compiler command line option like:
+// -DASSERT_SAMPLE_ENV=ASSERT_SAMPLE
+#  define ASSERT_SAMPLE_ENV "ASSERT_SAMPLE"
+#endif
+
 #ifndef SPEW_COLOR_ENV
 // Comment this line out to not use at compile time or to set using a
 // compiler command line option like:
@@ -143,18 +165,49 @@ void setSpewLevel(int level) {
 
 #define BUFLEN  1024
 
+// spewHex() dumps HEX_RECORD_LINES lines in each record, after the
+// message, so records can be up to BUFLEN + TAIL_MAX long.
+#define HEX_RECORD_LINES  12
+#define TAIL_MAX  (HEX_RECORD_LINES*SPEW_HEX_LINE_MAX + 32)
+
+
+static void syslogSend(uint32_t level, int errn,
+        const char *file, int line, const char *func,
+        const char *pre, size_t preLen,
+        const char *body, size_t bodyLen);
+
+// The syslog socket fd, or -1 if we are not spewing to syslog.
+static atomic_int syslogFd = -1;
+static bool syslogTee = false;
+
+static void indexRecord(FILE *stream, uint32_t level, pid_t pid,
+        size_t tid, const char *file, int line, int64_t usec,
+        const char *buffer);
+
+// The stream that we are writing an index for, or 0 if none.
+static FILE *_Atomic indexStream = 0;
+
+// The thread's own context tags, and the current context which is
+// &threadContext if it's 0.
+static __thread struct SpewContext threadContext;
+static __thread struct SpewContext *context = 0;
+
 // in-lining vspew() with inline may make debugging code a little harder.
 //
 // pre = "ERROR: ", "WARN: ", "NOTICE: ", "INFO: ", or "DEBUG: "
 //
+// tail is tailLen (< TAIL_MAX) chars that are added on a new line after
+// the fmt message, not counting in BUFLEN.
+//
 static void vspew(FILE *stream, int errn, const char *pre, const char *file,
-        int line, const char *func, const char *fmt, va_list ap, int level) {
+        int line, const char *func, const char *fmt, va_list ap, int level,
+        const char *tail, size_t tailLen) {
 
     // TODO: What the hell good is buffer when stream is 0?
 
     // We try to buffer this "spew" so that prints do not get intermixed
     // with other prints in multi-threaded programs.
-    char buffer[BUFLEN];
+    char buffer[BUFLEN + TAIL_MAX];
     int len = 0;
 
     bool isColor = false;
@@ -173,13 +226,39 @@ static void vspew(FILE *stream, int errn, const char *pre, const char *file,
     if(isColor)
         // https://stackoverflow.com/questions/4842424/list-of-ansi-color-escape-sequences
         len += snprintf(&buffer[len], BUFLEN, "\033[%s;1;7m", ttyColors[level]);
+    // The prefix without the color escape sequences is
+    // buffer[preStart, preEnd), for the syslog sink.
+    int preStart = len;
 #ifdef USER_PREFIX
     len += snprintf(&buffer[len], BUFLEN, "%s", USER_PREFIX);
 #endif
     if(strlen(pre))
         len += snprintf(&buffer[len], BUFLEN, "%s", pre);
+    int preEnd = len;
     if(isColor)
         len += snprintf(&buffer[len], BUFLEN, "\033[0m");
+    int body = len;
+
+    // TODO: very Linux specific code here:
+    pid_t pid = getpid();
+    size_t tid = syscall(SYS_gettid);
+
+    // Records to an indexed stream get a time stamp so that spewQuery
+    // can filter them by time.
+    bool indexed = (stream && stream == indexStream);
+    int64_t usec = 0;
+
+    if(indexed) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        usec = ((int64_t) ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+        len += snprintf(&buffer[len], BUFLEN,
+                " %s:%d:pid=%u:%zu:t=%" PRId64 ".%06" PRId64,
+                file, line, pid, tid,
+                usec/1000000, usec%1000000);
+    } else
+        len += snprintf(&buffer[len], BUFLEN, " %s:%d:pid=%u:%zu",
+                file, line, pid, tid);
 
     if(errn) {
 
@@ -188,17 +267,13 @@ static void vspew(FILE *stream, int errn, const char *pre, const char *file,
         // safe.  I'm fucked, there is no easy thread safe way to get the
         // system error string.
 
-        // TODO: very Linux specific code here:
         len += snprintf(&buffer[len], BUFLEN,
-                " %s:%d:pid=%u:%zu %s():errno=%d:%s: ",
-                file, line,
-                getpid(), syscall(SYS_gettid), func,
+                " %s():errno=%d:%s: ",
+                func,
                 errn, strerror(errn) /* How the fuck can they make this
                                         not thread safe */);
     } else
-        len += snprintf(&buffer[len], BUFLEN, " %s:%d:pid=%u:%zu %s(): ",
-                file, line,
-                getpid(), syscall(SYS_gettid), func);
+        len += snprintf(&buffer[len], BUFLEN, " %s(): ", func);
 
 
     if(len < 10 || len > BUFLEN - 40) {
@@ -232,24 +307,55 @@ static void vspew(FILE *stream, int errn, const char *pre, const char *file,
         return;
     }
 
+    struct SpewContext *ctx = context ? context : &threadContext;
+    if(ctx->len && len + ctx->len < BUFLEN - 1) {
+        memcpy(&buffer[len], ctx->tags, ctx->len);
+        len += ctx->len;
+    }
+
     int ret;
     ret = vsnprintf(&buffer[len], BUFLEN - len,  fmt, ap);
     if(ret > 0) len += ret;
-    if(len + 1 < BUFLEN) {
-        // Add newline to the end.
-        buffer[len] = '\n';
-        buffer[len+1] = '\0';
+    if(len > BUFLEN - 1)
+        // It got cut off.
+        len = BUFLEN - 1;
+    if(tailLen) {
+        buffer[len++] = '\n';
+        memcpy(&buffer[len], tail, tailLen);
+        len += tailLen;
     }
+    // Add newline to the end.
+    buffer[len] = '\n';
+    buffer[len+1] = '\0';
 
-    if(stream)
-        fputs(buffer, stream);
+    if(!stream) return;
+
+    if(syslogFd >= 0) {
+        size_t bodyLen = strlen(&buffer[body]);
+        // Not the trailing newline.
+        if(bodyLen && buffer[body + bodyLen - 1] == '\n')
+            --bodyLen;
+        syslogSend(level, errn, file, line, func,
+                &buffer[preStart], preEnd - preStart,
+                &buffer[body], bodyLen);
+        if(!syslogTee) return;
+    }
+
+    if(indexed) {
+        flockfile(stream);
+        indexRecord(stream, level, pid, tid, file, line, usec, buffer);
+        funlockfile(stream);
+        return;
+    }
+
+    fputs(buffer, stream);
 }
 
 
-void spew(uint32_t levelIn, FILE *stream, int errn,
-        const char *pre, const char *file,
-        int line, const char *func,
-        const char *fmt, ...)
+// Get the spew level and color from the environment, and return true if
+// we spew at levelIn.
+//
+static bool checkLevel(uint32_t levelIn)
 {
 
 #ifdef SPEW_LEVEL_ENV
@@ -345,14 +451,47 @@ void spew(uint32_t levelIn, FILE *stream, int errn,
     }
 #endif
  
-    if(levelIn > spewLevel)
-        // The spew level in is larger (more verbose) than one we let
-        // spew.
+    // The spew level in may be larger (more verbose) than one we let
+    // spew.
+    return levelIn <= spewLevel;
+}
+
+
+// The guts of spew(), _spewCold(), and _assertFail().
+//
+static void vspewLevel(uint32_t levelIn, FILE *stream, int errn,
+        const char *pre, const char *file,
+        int line, const char *func,
+        const char *fmt, va_list ap)
+{
+    if(!checkLevel(levelIn))
         return;
 
+    vspew(stream, errn, pre, file, line, func, fmt, ap, levelIn, 0, 0);
+}
+
+
+void spew(uint32_t levelIn, FILE *stream, int errn,
+        const char *pre, const char *file,
+        int line, const char *func,
+        const char *fmt, ...)
+{
     va_list ap;
     va_start(ap, fmt);
-    vspew(stream, errn, pre, file, line, func, fmt, ap, levelIn);
+    vspewLevel(levelIn, stream, errn, pre, file, line, func, fmt, ap);
+    va_end(ap);
+}
+
+
+// The same as spew() but it's SPEW_COLD; for RET_ERROR().
+void _spewCold(uint32_t levelIn, FILE *stream, int errn,
+        const char *pre, const char *file,
+        int line, const char *func,
+        const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vspewLevel(levelIn, stream, errn, pre, file, line, func, fmt, ap);
     va_end(ap);
 }
 
@@ -367,8 +506,6 @@ void (*assertAction)(FILE *stream, const char *file,
 void _assert(FILE *stream, const char *file,
         int lineNum, const char *func)
 {
-    pid_t pid;
-    pid = getpid();
     if(assertAction)
         // We call the users assert action.  If it does not exit that's
         // okay, we'll just fall into the default behavior.
@@ -378,9 +515,1477 @@ void _assert(FILE *stream, const char *file,
     exit(1); // atexit() calls are called
     // See `man 3 exit' and `man _exit'
 #else // ASSERT_ACTION_SLEEP
+    pid_t pid = getpid();
     int i = 1; // User debugger controller, unset to effect running code.
     fprintf(stream, "  Consider running: \n\n  gdb -pid %u\n\n  "
         "pid=%u:%zu will now SLEEP ...\n", pid, pid, syscall(SYS_gettid));
     while(i) { sleep(1); }
 #endif
 }
+
+
+
+void _assertFail(FILE *stream, int errn, const char *pre,
+        const char *file, int line, const char *func,
+        const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vspewLevel(1, stream, errn, pre, file, line, func, fmt, ap);
+    va_end(ap);
+    _assert(stream, file, line, func);
+}
+
+
+void _checkFail(FILE *stream, int errn, const char *pre, int ret,
+        const char *file, int line, const char *func)
+{
+    _spewCold(1, stream, errn, pre, file, line, func, "returned %d", ret);
+    _assert(stream, file, line, func);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// hex dumps
+///////////////////////////////////////////////////////////////////////
+//
+// A full hexdump -C line is 79 chars:
+//
+//   00000000  30 31 32 33 34 35 36 37  38 39 61 62 63 64 65 66  |0123456789abcdef|
+//
+// The 69 chars after the offset and two spaces are made by
+// hexLinesSsse3() or hexLinesAvx2() with nibble to hex digit shuffle
+// table lookups, and by hexLineScalar() for the last partial line and
+// CPUs without SSSE3.
+
+static const char hexDigits[] = "0123456789abcdef";
+
+
+// At least 8 hex digits of offset and two spaces.
+static char *hexOffset(char *o, size_t offset) {
+
+    int digits = 8;
+    while(digits < 2*(int) sizeof(offset) && (offset >> (4*digits)))
+        ++digits;
+    for(int i = digits - 1; i >= 0; --i) {
+        *o++ = hexDigits[(offset >> (4*i)) & 0xF];
+    }
+    *o++ = ' ';
+    *o++ = ' ';
+    return o;
+}
+
+
+static char *hexLineScalar(char *o, const uint8_t *p, size_t n,
+        size_t offset) {
+
+    o = hexOffset(o, offset);
+    for(size_t i = 0; i < 16; ++i) {
+        if(i < n) {
+            *o++ = hexDigits[p[i] >> 4];
+            *o++ = hexDigits[p[i] & 0xF];
+        } else {
+            *o++ = ' ';
+            *o++ = ' ';
+        }
+        *o++ = ' ';
+        if(i == 7)
+            *o++ = ' ';
+    }
+    *o++ = ' ';
+    *o++ = '|';
+    for(size_t i = 0; i < n; ++i)
+        *o++ = (p[i] >= 0x20 && p[i] < 0x7F) ? p[i] : '.';
+    *o++ = '|';
+    *o++ = '\n';
+    return o;
+}
+
+
+// Full lines with the scalar code.
+static char *hexLinesScalar(char *o, const uint8_t *p, size_t lines,
+        size_t offset) {
+
+    for(size_t i = 0; i < lines; ++i, p += 16, offset += 16)
+        o = hexLineScalar(o, p, 16, offset);
+    return o;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+#  include <immintrin.h>
+
+// Write the 69 chars after the offset from hex, the interleaved hex
+// digits of the 16 bytes (hexA bytes 0-7, hexB bytes 8-15), and ascii,
+// the printable chars.  The stores are in order so that each one writes
+// over the don't care end of the one before it; the last store ends at
+// o[66].
+__attribute__ ( ( target ("ssse3") ) )
+static inline void hexStoreSsse3(char *o, __m128i hexA, __m128i hexB,
+        __m128i ascii) {
+
+    // "xx xx xx xx xx xx xx xx " from 16 hex digits in two shuffles.
+    // The spaces come from -1 indexes that shuffle in 0, and or-ing
+    // everything with ' ', which the hex digits have set already.
+    const __m128i m1 = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1,
+            6, 7, -1, 8, 9, -1, 10);
+    const __m128i m2 = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i space = _mm_set1_epi8(' ');
+
+    _mm_storeu_si128((__m128i *) &o[0],
+            _mm_or_si128(_mm_shuffle_epi8(hexA, m1), space));
+    _mm_storeu_si128((__m128i *) &o[16],
+            _mm_or_si128(_mm_shuffle_epi8(hexA, m2), space));
+    _mm_storeu_si128((__m128i *) &o[25],
+            _mm_or_si128(_mm_shuffle_epi8(hexB, m1), space));
+    _mm_storeu_si128((__m128i *) &o[41],
+            _mm_or_si128(_mm_shuffle_epi8(hexB, m2), space));
+    o[49] = ' ';
+    o[50] = '|';
+    _mm_storeu_si128((__m128i *) &o[51], ascii);
+    o[67] = '|';
+    o[68] = '\n';
+}
+
+
+// hexOffset() for offsets that fit in 8 hex digits.
+__attribute__ ( ( target ("ssse3") ) )
+static inline char *hexOffsetSsse3(char *o, size_t offset,
+        __m128i table, __m128i mask) {
+
+    if((uint64_t) offset >> 32)
+        return hexOffset(o, offset);
+
+    // Big endian, so the most significant digits are first.
+    __m128i v = _mm_cvtsi32_si128(__builtin_bswap32((uint32_t) offset));
+    __m128i hi = _mm_shuffle_epi8(table,
+            _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+    __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(v, mask));
+    _mm_storel_epi64((__m128i *) o, _mm_unpacklo_epi8(hi, lo));
+    o[8] = ' ';
+    o[9] = ' ';
+    return o + 10;
+}
+
+
+__attribute__ ( ( target ("ssse3") ) )
+static char *hexLinesSsse3(char *o, const uint8_t *p, size_t lines,
+        size_t offset) {
+
+    const __m128i table = _mm_loadu_si128((const __m128i *) hexDigits);
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    const __m128i low = _mm_set1_epi8(0x1F);
+    const __m128i high = _mm_set1_epi8(0x7F);
+    const __m128i dot = _mm_set1_epi8('.');
+
+    for(size_t i = 0; i < lines; ++i, p += 16, offset += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i hi = _mm_shuffle_epi8(table,
+                _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+        __m128i lo = _mm_shuffle_epi8(table, _mm_and_si128(v, mask));
+        // Signed compares, so 0x80 to 0xFF are not printable.
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, low),
+                _mm_cmplt_epi8(v, high));
+        __m128i ascii = _mm_or_si128(_mm_and_si128(printable, v),
+                _mm_andnot_si128(printable, dot));
+        o = hexOffsetSsse3(o, offset, table, mask);
+        hexStoreSsse3(o, _mm_unpacklo_epi8(hi, lo),
+                _mm_unpackhi_epi8(hi, lo), ascii);
+        o += 69;
+    }
+    return o;
+}
+
+
+// Two lines at a time.
+__attribute__ ( ( target ("avx2") ) )
+static char *hexLinesAvx2(char *o, const uint8_t *p, size_t lines,
+        size_t offset) {
+
+    const __m128i table128 = _mm_loadu_si128((const __m128i *) hexDigits);
+    const __m128i mask128 = _mm_set1_epi8(0x0F);
+    const __m256i table = _mm256_broadcastsi128_si256(table128);
+    const __m256i mask = _mm256_set1_epi8(0x0F);
+    const __m256i low = _mm256_set1_epi8(0x1F);
+    const __m256i high = _mm256_set1_epi8(0x7F);
+    const __m256i dot = _mm256_set1_epi8('.');
+
+    size_t i = 0;
+    for(; i + 2 <= lines; i += 2, p += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i hi = _mm256_shuffle_epi8(table,
+                _mm256_and_si256(_mm256_srli_epi16(v, 4), mask));
+        __m256i lo = _mm256_shuffle_epi8(table,
+                _mm256_and_si256(v, mask));
+        __m256i printable = _mm256_and_si256(
+                _mm256_cmpgt_epi8(v, low), _mm256_cmpgt_epi8(high, v));
+        __m256i ascii = _mm256_or_si256(_mm256_and_si256(printable, v),
+                _mm256_andnot_si256(printable, dot));
+        // The unpacks are in 128 bit lanes, so the low lane is the
+        // first line and the high lane is the second line.
+        __m256i hexA = _mm256_unpacklo_epi8(hi, lo);
+        __m256i hexB = _mm256_unpackhi_epi8(hi, lo);
+
+        o = hexOffsetSsse3(o, offset, table128, mask128);
+        hexStoreSsse3(o, _mm256_castsi256_si128(hexA),
+                _mm256_castsi256_si128(hexB),
+                _mm256_castsi256_si128(ascii));
+        o += 69;
+        offset += 16;
+
+        o = hexOffsetSsse3(o, offset, table128, mask128);
+        hexStoreSsse3(o, _mm256_extracti128_si256(hexA, 1),
+                _mm256_extracti128_si256(hexB, 1),
+                _mm256_extracti128_si256(ascii, 1));
+        o += 69;
+        offset += 16;
+    }
+
+    if(i < lines)
+        o = hexLinesSsse3(o, p, lines - i, offset);
+    return o;
+}
+
+#endif // #if defined(__x86_64__) || defined(__i386__)
+
+
+// Points to the best full line hex dumper this CPU can run.
+static char *(*hexLines)(char *o, const uint8_t *p, size_t lines,
+        size_t offset) = 0;
+
+
+size_t spewHexFormat(char *out, const void *ptr, size_t len,
+        size_t offset) {
+
+    if(!hexLines) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx2"))
+            hexLines = hexLinesAvx2;
+        else if(__builtin_cpu_supports("ssse3"))
+            hexLines = hexLinesSsse3;
+        else
+#endif
+            hexLines = hexLinesScalar;
+    }
+
+    const uint8_t *p = ptr;
+    size_t lines = len/16;
+    char *o = hexLines(out, p, lines, offset);
+    if(len % 16)
+        o = hexLineScalar(o, p + lines*16, len % 16, offset + lines*16);
+    return o - out;
+}
+
+
+static void spewTail(FILE *stream, int errn, const char *pre,
+        const char *file, int line, const char *func, int level,
+        const char *tail, size_t tailLen, const char *fmt, ...) {
+
+    va_list ap;
+    va_start(ap, fmt);
+    vspew(stream, errn, pre, file, line, func, fmt, ap, level,
+            tail, tailLen);
+    va_end(ap);
+}
+
+
+void spewHex(uint32_t levelIn, FILE *stream, int errn, const char *pre,
+        const char *file, int line, const char *func,
+        const void *ptr, size_t len, const char *fmt, ...)
+{
+    if(!checkLevel(levelIn))
+        return;
+
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+
+    const uint8_t *p = ptr;
+    size_t lines = (len + 15)/16;
+    size_t parts = lines ? (lines + HEX_RECORD_LINES - 1)/HEX_RECORD_LINES : 1;
+    size_t offset = 0;
+    char tail[TAIL_MAX];
+
+    for(size_t part = 1; part <= parts; ++part) {
+
+        size_t n = len - offset;
+        if(n > HEX_RECORD_LINES*16)
+            n = HEX_RECORD_LINES*16;
+        size_t tailLen = spewHexFormat(tail, p + offset, n, offset);
+        offset += n;
+
+        if(offset == len) {
+            // hexdump -C ends with the length.
+            char *o = hexOffset(&tail[tailLen], len);
+            tailLen = o - tail - 2;
+        } else
+            // Not the last newline; vspew() adds it.
+            --tailLen;
+
+        spewTail(stream, errn, pre, file, line, func, levelIn,
+                tail, tailLen, "%s%s[%zu bytes, part %zu of %zu]",
+                msg, msg[0] ? " " : "", len, part, parts);
+    }
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// thread context tags
+///////////////////////////////////////////////////////////////////////
+
+
+int spewContextPush(const char *key, const char *fmt, ...) {
+
+    struct SpewContext *ctx = context ? context : &threadContext;
+
+    if(ctx->depth >= SPEW_CONTEXT_DEPTH) {
+        // Too deep to remember the length, so spewContextPop() will
+        // just count it.
+        ++ctx->depth;
+        return -1;
+    }
+
+    uint32_t len = ctx->len;
+    ctx->pushLen[ctx->depth++] = len;
+
+    int ret = snprintf(&ctx->tags[len], SPEW_CONTEXT_LEN - len,
+            "%s=", key);
+    if(ret > 0 && len + ret < SPEW_CONTEXT_LEN) {
+        len += ret;
+        va_list ap;
+        va_start(ap, fmt);
+        ret = vsnprintf(&ctx->tags[len], SPEW_CONTEXT_LEN - len, fmt, ap);
+        va_end(ap);
+        // Room for the " " too.
+        if(ret >= 0 && len + ret + 1 < SPEW_CONTEXT_LEN) {
+            len += ret;
+            ctx->tags[len++] = ' ';
+            ctx->tags[len] = '\0';
+            ctx->len = len;
+            return 0;
+        }
+    }
+
+    // It did not fit.  Leave it empty.
+    ctx->tags[ctx->len] = '\0';
+    return -1;
+}
+
+
+void spewContextPop(void) {
+
+    struct SpewContext *ctx = context ? context : &threadContext;
+
+    if(!ctx->depth) return;
+
+    if(--ctx->depth < SPEW_CONTEXT_DEPTH) {
+        ctx->len = ctx->pushLen[ctx->depth];
+        ctx->tags[ctx->len] = '\0';
+    }
+}
+
+
+struct SpewContext *spewContextSwap(struct SpewContext *ctx) {
+
+    struct SpewContext *old = context ? context : &threadContext;
+    context = (ctx == &threadContext) ? 0 : ctx;
+    return old;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// async-signal-safe spew
+///////////////////////////////////////////////////////////////////////
+//
+// Nothing in here may use stdio, malloc(3), locks, or anything else
+// that is not async-signal-safe, except where noted.
+
+
+// Write the digits of val in base to the end of tmp[24] and return a
+// pointer to the first digit.
+static char *safeUtoa(char *tmp, unsigned long long val, unsigned base,
+        bool upper) {
+
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char *p = tmp + 24;
+    do {
+        *--p = digits[val % base];
+        val /= base;
+    } while(val);
+    return p;
+}
+
+
+// A small reentrant vsnprintf(3).  Returns the length written, not
+// counting the terminating '\0'; which may be truncated to size - 1.
+//
+// It does %d %i %u %o %x %X %p %s %c and %% with the hh, h, l, ll, j,
+// z and t length modifiers, the - and 0 flags, and field width and
+// precision, with * for either.  Floating point conversions eat their
+// double and are written as "%f" and the like.  Anything else stops the
+// formatting, so that we never va_arg() the wrong type.
+//
+static size_t safeFormat(char *buf, size_t size, const char *fmt,
+        va_list ap) {
+
+    size_t len = 0;
+
+#define PUT(c)  do { if(len + 1 < size) buf[len++] = (c); } while(0)
+
+    while(*fmt) {
+
+        if(*fmt != '%') {
+            PUT(*fmt++);
+            continue;
+        }
+        const char *conv = fmt++;
+
+        bool left = false, zero = false;
+        for(;; ++fmt) {
+            if(*fmt == '-') left = true;
+            else if(*fmt == '0') zero = true;
+            else if(*fmt != ' ' && *fmt != '+' && *fmt != '#') break;
+        }
+
+        int width = 0;
+        if(*fmt == '*') {
+            width = va_arg(ap, int);
+            if(width < 0) {
+                left = true;
+                width = -width;
+            }
+            ++fmt;
+        } else
+            while(*fmt >= '0' && *fmt <= '9')
+                width = width*10 + (*fmt++ - '0');
+
+        // precision < 0 is none.
+        int precision = -1;
+        if(*fmt == '.') {
+            ++fmt;
+            precision = 0;
+            if(*fmt == '*') {
+                precision = va_arg(ap, int);
+                ++fmt;
+            } else
+                while(*fmt >= '0' && *fmt <= '9')
+                    precision = precision*10 + (*fmt++ - '0');
+        }
+
+        int lng = 0, shrt = 0;
+        bool sz = false, longDouble = false;
+        for(;; ++fmt) {
+            if(*fmt == 'l') ++lng;
+            else if(*fmt == 'h') ++shrt;
+            else if(*fmt == 'j') lng = 2;
+            else if(*fmt == 'z' || *fmt == 't') sz = true;
+            else if(*fmt == 'L') longDouble = true;
+            else break;
+        }
+
+        char tmp[24];
+        const char *str = tmp;
+        const char *prefix = "";
+        size_t n = 0;
+        unsigned long long u;
+        bool number = false;
+
+        switch(*fmt) {
+            case 'd':
+            case 'i':
+            {
+                long long v;
+                if(sz) v = va_arg(ap, ssize_t);
+                else if(lng >= 2) v = va_arg(ap, long long);
+                else if(lng) v = va_arg(ap, long);
+                else {
+                    v = va_arg(ap, int);
+                    if(shrt >= 2) v = (signed char) v;
+                    else if(shrt) v = (short) v;
+                }
+                if(v < 0) {
+                    prefix = "-";
+                    u = - (unsigned long long) v;
+                } else
+                    u = v;
+                str = safeUtoa(tmp, u, 10, false);
+                n = tmp + 24 - str;
+                number = true;
+                break;
+            }
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                if(sz) u = va_arg(ap, size_t);
+                else if(lng >= 2) u = va_arg(ap, unsigned long long);
+                else if(lng) u = va_arg(ap, unsigned long);
+                else {
+                    u = va_arg(ap, unsigned int);
+                    if(shrt >= 2) u = (unsigned char) u;
+                    else if(shrt) u = (unsigned short) u;
+                }
+                str = safeUtoa(tmp, u,
+                        (*fmt == 'u') ? 10 : (*fmt == 'o') ? 8 : 16,
+                        *fmt == 'X');
+                n = tmp + 24 - str;
+                number = true;
+                break;
+            case 'p':
+                u = (uintptr_t) va_arg(ap, void *);
+                prefix = "0x";
+                str = safeUtoa(tmp, u, 16, false);
+                n = tmp + 24 - str;
+                number = true;
+                break;
+            case 's':
+                str = va_arg(ap, const char *);
+                if(!str) str = "(null)";
+                // Not strlen(), str need not be terminated with a
+                // precision.
+                while((precision < 0 || n < (size_t) precision) && str[n])
+                    ++n;
+                zero = false;
+                break;
+            case 'c':
+                tmp[0] = (char) va_arg(ap, int);
+                n = 1;
+                zero = false;
+                break;
+            case '%':
+                tmp[0] = '%';
+                n = 1;
+                break;
+            case 'f': case 'F':
+            case 'e': case 'E':
+            case 'g': case 'G':
+            case 'a': case 'A':
+                // We don't do floating point, but we eat the argument so
+                // the ones after it line up.
+                if(longDouble)
+                    (void) va_arg(ap, long double);
+                else
+                    (void) va_arg(ap, double);
+                tmp[0] = '%';
+                tmp[1] = *fmt;
+                n = 2;
+                zero = false;
+                break;
+            default:
+                // Not something we do.  We can't know what to va_arg()
+                // for it, so we write the rest of fmt as is.
+                for(fmt = conv; *fmt; ++fmt)
+                    PUT(*fmt);
+                continue;
+        }
+        ++fmt;
+
+        // Integer precision is the least number of digits.
+        size_t zeros = 0;
+        if(number && precision >= 0) {
+            if(precision == 0 && n == 1 && str[0] == '0')
+                n = 0;
+            if((size_t) precision > n)
+                zeros = precision - n;
+            zero = false;
+        }
+
+        size_t plen = strlen(prefix);
+        int pad = width - (int) (n + zeros + plen);
+        if(!left && !zero)
+            for(; pad > 0; --pad) PUT(' ');
+        for(size_t i = 0; i < plen; ++i) PUT(prefix[i]);
+        if(!left && zero)
+            for(; pad > 0; --pad) PUT('0');
+        for(; zeros; --zeros) PUT('0');
+        for(size_t i = 0; i < n; ++i) PUT(str[i]);
+        for(; pad > 0; --pad) PUT(' ');
+    }
+
+#undef PUT
+
+    if(size)
+        buf[len] = '\0';
+    return len;
+}
+
+
+static size_t safeSnprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t len = safeFormat(buf, size, fmt, ap);
+    va_end(ap);
+    return len;
+}
+
+
+static void safeWrite(int fd, const char *buf, size_t len) {
+
+    while(len) {
+        ssize_t ret = write(fd, buf, len);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0)
+            return;
+        buf += ret;
+        len -= ret;
+    }
+}
+
+
+void safeSpew(uint32_t level, int fd, int errn, const char *pre,
+        const char *file, int line, const char *func,
+        const char *fmt, ...)
+{
+    if(fd < 0 || level > spewLevel)
+        return;
+
+    // Don't let write(2) change errno on the interrupted code.
+    int saveErrno = errno;
+    char buffer[BUFLEN];
+    size_t len;
+
+#ifdef USER_PREFIX
+    len = safeSnprintf(buffer, BUFLEN, "%s%s %s:%d:pid=%u:%ld %s():",
+            USER_PREFIX, pre, file, line, getpid(),
+            syscall(SYS_gettid), func);
+#else
+    len = safeSnprintf(buffer, BUFLEN, "%s %s:%d:pid=%u:%ld %s():",
+            pre, file, line, getpid(), syscall(SYS_gettid), func);
+#endif
+    if(errn)
+        len += safeSnprintf(&buffer[len], BUFLEN - len, "errno=%d:", errn);
+    len += safeSnprintf(&buffer[len], BUFLEN - len, " ");
+
+    struct SpewContext *ctx = context ? context : &threadContext;
+    if(ctx->len && len + ctx->len < BUFLEN - 1) {
+        memcpy(&buffer[len], ctx->tags, ctx->len);
+        len += ctx->len;
+    }
+
+    va_list ap;
+    va_start(ap, fmt);
+    len += safeFormat(&buffer[len], BUFLEN - len - 1, fmt, ap);
+    va_end(ap);
+    buffer[len++] = '\n';
+
+    safeWrite(fd, buffer, len);
+    errno = saveErrno;
+}
+
+
+// The load map cache.  It's written by spewLoadMapRefresh() which is not
+// async-signal-safe and read in signal handlers.
+
+#define LOAD_MAP_SEGMENTS  512
+#define LOAD_MAP_NAMES     (32*1024)
+
+struct LoadSegment {
+    uintptr_t start, end; // [start, end) mapped
+    uintptr_t base;       // load base of the object
+    uint32_t name;        // index into loadMapNames
+};
+
+static struct LoadSegment loadMap[LOAD_MAP_SEGMENTS];
+static atomic_uint loadMapLen = 0;
+static char loadMapNames[LOAD_MAP_NAMES];
+static pthread_mutex_t loadMapMutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct LoadMapBuild {
+    uint32_t len;
+    uint32_t namesLen;
+};
+
+
+static int loadMapAdd(struct dl_phdr_info *info, size_t size, void *data) {
+
+    (void) size;
+    struct LoadMapBuild *b = data;
+    const char *name = info->dlpi_name;
+    char exe[512];
+
+    if(!name || !name[0]) {
+        // The program.
+        ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        if(n < 0) n = 0;
+        exe[n] = '\0';
+        name = exe;
+    }
+
+    size_t nameLen = strlen(name) + 1;
+    if(b->namesLen + nameLen > LOAD_MAP_NAMES)
+        return 1;
+    uint32_t nameIndex = b->namesLen;
+    memcpy(&loadMapNames[nameIndex], name, nameLen);
+    b->namesLen += nameLen;
+
+    for(int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if(ph->p_type != PT_LOAD) continue;
+        if(b->len >= LOAD_MAP_SEGMENTS)
+            return 1;
+        struct LoadSegment *seg = &loadMap[b->len++];
+        seg->start = info->dlpi_addr + ph->p_vaddr;
+        seg->end = seg->start + ph->p_memsz;
+        seg->base = info->dlpi_addr;
+        seg->name = nameIndex;
+    }
+    return 0;
+}
+
+
+void spewLoadMapRefresh(void) {
+
+    pthread_mutex_lock(&loadMapMutex);
+    // A signal handler that runs while we rebuild sees no map and just
+    // spews addresses.
+    loadMapLen = 0;
+    struct LoadMapBuild b = { 0, 0 };
+    dl_iterate_phdr(loadMapAdd, &b);
+    loadMapLen = b.len;
+    pthread_mutex_unlock(&loadMapMutex);
+}
+
+
+#define BACKTRACE_DEPTH  64
+
+
+void safeSpewBacktrace(int fd) {
+
+    int saveErrno = errno;
+    void *addrs[BACKTRACE_DEPTH];
+    // backtrace(3) is not async-signal-safe the first time it's called,
+    // when it loads libgcc_s; spewCrashCatch() calls it first.
+    int n = backtrace(addrs, BACKTRACE_DEPTH);
+    uint32_t mapLen = loadMapLen;
+    char buffer[BUFLEN];
+
+    size_t len = safeSnprintf(buffer, sizeof(buffer),
+            "backtrace pid=%u:%ld (get function and line with: "
+            "addr2line -f -i -e OBJECT OFFSET):\n",
+            getpid(), syscall(SYS_gettid));
+    safeWrite(fd, buffer, len);
+
+    // Frame 0 is us.
+    for(int i = 1; i < n; ++i) {
+        uintptr_t addr = (uintptr_t) addrs[i];
+        const struct LoadSegment *seg = 0;
+        for(uint32_t j = 0; j < mapLen; ++j)
+            if(addr >= loadMap[j].start && addr < loadMap[j].end) {
+                seg = &loadMap[j];
+                break;
+            }
+        if(seg)
+            // addr is a return address, so addr - 1 is in the call.
+            len = safeSnprintf(buffer, sizeof(buffer),
+                    "  #%-2d %p %s 0x%lx\n", i - 1, addrs[i],
+                    &loadMapNames[seg->name],
+                    (unsigned long) (addr - 1 - seg->base));
+        else
+            len = safeSnprintf(buffer, sizeof(buffer),
+                    "  #%-2d %p ?\n", i - 1, addrs[i]);
+        safeWrite(fd, buffer, len);
+    }
+
+    errno = saveErrno;
+}
+
+
+static const int crashSignals[] = {
+    SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+
+static void crashCatcher(int sig, siginfo_t *info, void *ucontext) {
+
+    (void) ucontext;
+    const char *name;
+    switch(sig) {
+        case SIGSEGV: name = "SIGSEGV"; break;
+        case SIGBUS:  name = "SIGBUS";  break;
+        case SIGFPE:  name = "SIGFPE";  break;
+        case SIGILL:  name = "SIGILL";  break;
+        case SIGABRT: name = "SIGABRT"; break;
+        default:      name = "signal";  break;
+    }
+
+    char buffer[128];
+    size_t len = safeSnprintf(buffer, sizeof(buffer),
+            "CRASH: pid=%u:%ld caught %s (%d) code=%d addr=%p\n",
+            getpid(), syscall(SYS_gettid), name, sig,
+            info->si_code, info->si_addr);
+    safeWrite(SPEW_FD, buffer, len);
+
+    safeSpewBacktrace(SPEW_FD);
+
+    // SA_RESETHAND put back the default action, so this kills us with
+    // the signal, with a core dump if they are on.
+    raise(sig);
+}
+
+
+int spewCrashCatch(void) {
+
+    // Not async-signal-safe things to do before we need them.
+    void *addrs[2];
+    backtrace(addrs, 2);
+    spewLoadMapRefresh();
+
+    static char *altStack = 0;
+    if(!altStack) {
+        size_t size = 64*1024;
+        if(size < (size_t) SIGSTKSZ) size = SIGSTKSZ;
+        altStack = malloc(size);
+        if(!altStack)
+            return -1;
+        stack_t ss;
+        memset(&ss, 0, sizeof(ss));
+        ss.ss_sp = altStack;
+        ss.ss_size = size;
+        if(sigaltstack(&ss, 0))
+            return -1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = crashCatcher;
+    sa.sa_flags = SA_SIGINFO|SA_ONSTACK|SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+
+    for(size_t i = 0; i < sizeof(crashSignals)/sizeof(crashSignals[0]);
+            ++i)
+        if(sigaction(crashSignals[i], &sa, 0))
+            return -1;
+
+    return 0;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// syslog/journald sink
+///////////////////////////////////////////////////////////////////////
+//
+// Spew records are formatted by the spewing thread and put in a bounded
+// ring queue.  NOTICE and more severe records are sent right away, with
+// any queued before them.  INFO and DEBUG records wait in the queue until
+// SYSLOG_BATCH of them are queued or the oldest is SYSLOG_BATCH_MSEC old
+// at the next spew, or spewSyslogFlush(), spewSyslogClose() or exit(3).
+// The thread that finds the queue due and not being flushed flushes it
+// with sendmmsg(2), so a heavy spewer sends a batch of records in one
+// system call, and records that pile up while the flusher is in
+// sendmmsg(2) go in the next one.  If
+// the daemon is not keeping up the socket gives EAGAIN and the records
+// stay queued.  When the queue is full and flushing it still stalls, new
+// records are dropped and counted.
+//
+// We can't use CHECK() or ASSERT() in here, they spew.
+
+
+#define SYSLOG_QUEUE_LEN   64  // Must be a power of 2.
+// Send when this many records are queued,
+#define SYSLOG_BATCH       (SYSLOG_QUEUE_LEN/2)
+// or when the oldest queued record is this old,
+#define SYSLOG_BATCH_MSEC  100
+// or right away for records at this spew level and more severe.
+#define SYSLOG_NOW_LEVEL   3
+// Room for the syslog or journald fields before the message.
+#define SYSLOG_HEADER_LEN  512
+#define SYSLOG_RECORD_LEN  (SYSLOG_HEADER_LEN + BUFLEN + TAIL_MAX)
+
+struct SyslogRecord {
+    size_t len;
+    char data[SYSLOG_RECORD_LEN];
+};
+
+static pthread_mutex_t syslogMutex = PTHREAD_MUTEX_INITIALIZER;
+static int syslogFormat = SPEW_SYSLOG_RFC3164;
+static char syslogIdent[64];
+// A thread is calling sendmmsg(2) for records [syslogHead, syslogTail).
+static bool syslogFlushing = false;
+// Queued records are [syslogHead, syslogTail), modulo SYSLOG_QUEUE_LEN.
+static uint32_t syslogHead = 0, syslogTail = 0;
+// When the record at syslogHead was queued, in CLOCK_MONOTONIC_COARSE
+// milliseconds.
+static uint64_t syslogOldest = 0;
+static struct SyslogRecord syslogQueue[SYSLOG_QUEUE_LEN];
+static atomic_uint_fast64_t syslogDropped = 0;
+
+
+// Spew level to syslog severity, see syslog(3).
+//
+//      level:           0  1  2  3  4  5
+static const int syslogSeverity[] = { 3, 3, 4, 5, 6, 7 };
+// LOG_USER
+#define SYSLOG_FACILITY  1
+
+
+static size_t syslogFormatRecord(char *out, uint32_t level, int errn,
+        const char *file, int line, const char *func,
+        const char *pre, size_t preLen,
+        const char *body, size_t bodyLen) {
+
+    int pri = syslogSeverity[level > 5 ? 5 : level];
+    size_t len;
+
+    if(syslogFormat == SPEW_SYSLOG_JOURNALD) {
+        // https://systemd.io/JOURNAL_NATIVE_PROTOCOL/
+        len = snprintf(out, SYSLOG_HEADER_LEN,
+                "PRIORITY=%d\nSYSLOG_IDENTIFIER=%s\nSYSLOG_PID=%u\n"
+                "TID=%ld\nCODE_FILE=%s\nCODE_LINE=%d\nCODE_FUNC=%s\n",
+                pri, syslogIdent, getpid(), syscall(SYS_gettid),
+                file, line, func);
+        if(errn && len < SYSLOG_HEADER_LEN)
+            len += snprintf(&out[len], SYSLOG_HEADER_LEN - len,
+                    "ERRNO=%d\n", errn);
+        if(len > SYSLOG_HEADER_LEN - 17)
+            // This should not happen.  Leave room for MESSAGE.
+            len = SYSLOG_HEADER_LEN - 17;
+        // MESSAGE in the binary form so that the message may have
+        // newlines in it.
+        uint64_t n = preLen + bodyLen;
+        memcpy(&out[len], "MESSAGE\n", 8);
+        len += 8;
+        for(int i = 0; i < 8; ++i)
+            out[len++] = (char) (n >> (8*i));
+    } else {
+        // RFC 3164 as the local syslog socket wants it.
+        char stamp[32];
+        struct tm tm;
+        time_t t = time(0);
+        localtime_r(&t, &tm);
+        strftime(stamp, sizeof(stamp), "%b %e %H:%M:%S", &tm);
+        len = snprintf(out, SYSLOG_HEADER_LEN,
+                "<%d>%s %s[%u]: ", SYSLOG_FACILITY*8 + pri,
+                stamp, syslogIdent, getpid());
+        if(len > SYSLOG_HEADER_LEN - 1)
+            // This should not happen.
+            len = SYSLOG_HEADER_LEN - 1;
+    }
+
+    // preLen + bodyLen < BUFLEN + TAIL_MAX from vspew().
+    memcpy(&out[len], pre, preLen);
+    len += preLen;
+    memcpy(&out[len], body, bodyLen);
+    len += bodyLen;
+
+    if(syslogFormat == SPEW_SYSLOG_JOURNALD)
+        out[len++] = '\n';
+
+    return len;
+}
+
+
+// Send records [head, tail) with as few sendmmsg(2) calls as we can.
+// Returns the number of records that are done with, sent or dropped.
+// Sets *stalled if the socket would block.
+static uint32_t syslogFlush(int fd, uint32_t head, uint32_t tail,
+        bool *stalled) {
+
+    struct mmsghdr msgs[SYSLOG_QUEUE_LEN];
+    struct iovec iovs[SYSLOG_QUEUE_LEN];
+    uint32_t n = tail - head;
+
+    memset(msgs, 0, n*sizeof(*msgs));
+    for(uint32_t i = 0; i < n; ++i) {
+        struct SyslogRecord *r =
+            &syslogQueue[(head + i) & (SYSLOG_QUEUE_LEN - 1)];
+        iovs[i].iov_base = r->data;
+        iovs[i].iov_len = r->len;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    uint32_t done = 0;
+    while(done < n) {
+        int ret = sendmmsg(fd, &msgs[done], n - done, MSG_DONTWAIT);
+        if(ret > 0) {
+            done += ret;
+            continue;
+        }
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                    errno == ENOBUFS)) {
+            // The daemon is slow.  Leave the rest queued.
+            *stalled = true;
+            break;
+        }
+        // The first record could not be sent at all; like the daemon
+        // is gone or the record is too large.  Drop it and go on.
+        ++syslogDropped;
+        ++done;
+    }
+    return done;
+}
+
+
+static uint64_t syslogMsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ((uint64_t) ts.tv_sec)*1000 + ts.tv_nsec/1000000;
+}
+
+
+// Send what is queued until it's all sent or the socket stalls.  Call
+// with syslogMutex locked and syslogFlushing false.
+static void syslogFlushQueue(void) {
+
+    syslogFlushing = true;
+    bool stalled = false;
+    while(syslogHead != syslogTail && !stalled) {
+        uint32_t head = syslogHead, tail = syslogTail;
+        int fd = syslogFd;
+        // Other threads may queue more while we send; they do not touch
+        // records [head, tail) or syslogHead.
+        pthread_mutex_unlock(&syslogMutex);
+        uint32_t done = syslogFlush(fd, head, tail, &stalled);
+        pthread_mutex_lock(&syslogMutex);
+        syslogHead += done;
+    }
+    syslogFlushing = false;
+    if(syslogHead != syslogTail)
+        // Stalled.  Don't wait another SYSLOG_BATCH_MSEC to retry.
+        syslogOldest = 0;
+}
+
+
+static void syslogSend(uint32_t level, int errn,
+        const char *file, int line, const char *func,
+        const char *pre, size_t preLen,
+        const char *body, size_t bodyLen) {
+
+    // Format outside the lock.
+    struct SyslogRecord r;
+    r.len = syslogFormatRecord(r.data, level, errn, file, line, func,
+            pre, preLen, body, bodyLen);
+
+    pthread_mutex_lock(&syslogMutex);
+
+    if(syslogFd < 0) {
+        pthread_mutex_unlock(&syslogMutex);
+        return;
+    }
+
+    if(syslogTail - syslogHead >= SYSLOG_QUEUE_LEN && !syslogFlushing)
+        // The queue filled while the daemon was stalled.  It may have
+        // caught up since.
+        syslogFlushQueue();
+
+    if(syslogTail - syslogHead >= SYSLOG_QUEUE_LEN) {
+        pthread_mutex_unlock(&syslogMutex);
+        ++syslogDropped;
+        return;
+    }
+
+    struct SyslogRecord *q =
+        &syslogQueue[syslogTail & (SYSLOG_QUEUE_LEN - 1)];
+    q->len = r.len;
+    memcpy(q->data, r.data, r.len);
+    if(syslogHead == syslogTail)
+        syslogOldest = (level <= SYSLOG_NOW_LEVEL) ? 0 : syslogMsec();
+    ++syslogTail;
+
+    if(syslogFlushing) {
+        // The flushing thread will get it.
+        pthread_mutex_unlock(&syslogMutex);
+        return;
+    }
+
+    if(level > SYSLOG_NOW_LEVEL &&
+            syslogTail - syslogHead < SYSLOG_BATCH &&
+            syslogMsec() - syslogOldest < SYSLOG_BATCH_MSEC) {
+        // Wait for more to send with it.
+        pthread_mutex_unlock(&syslogMutex);
+        return;
+    }
+
+    syslogFlushQueue();
+
+    pthread_mutex_unlock(&syslogMutex);
+}
+
+
+int spewSyslogSetFd(int fd, int format, const char *ident) {
+
+    if(fd < 0) {
+        errno = EBADF;
+        return -1;
+    }
+
+    spewSyslogClose();
+
+    pthread_mutex_lock(&syslogMutex);
+    syslogFormat = format & ~SPEW_SYSLOG_TEE;
+    syslogTee = (format & SPEW_SYSLOG_TEE) ? true : false;
+    snprintf(syslogIdent, sizeof(syslogIdent), "%s",
+            ident ? ident : program_invocation_short_name);
+    syslogHead = syslogTail = 0;
+    syslogFd = fd;
+    pthread_mutex_unlock(&syslogMutex);
+
+    return 0;
+}
+
+
+int spewSyslogOpen(const char *path, int format, const char *ident) {
+
+    if(!path)
+        path = ((format & ~SPEW_SYSLOG_TEE) == SPEW_SYSLOG_JOURNALD) ?
+            "/run/systemd/journal/socket" : "/dev/log";
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM|SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return -1;
+
+    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return spewSyslogSetFd(fd, format, ident);
+}
+
+
+void spewSyslogFlush(void) {
+
+    pthread_mutex_lock(&syslogMutex);
+    if(syslogFd >= 0 && !syslogFlushing)
+        syslogFlushQueue();
+    pthread_mutex_unlock(&syslogMutex);
+}
+
+
+// Don't leave INFO and DEBUG records queued at exit(3).
+__attribute__ ( ( destructor ) )
+static void syslogAtExit(void) {
+    spewSyslogFlush();
+}
+
+
+void spewSyslogClose(void) {
+
+    pthread_mutex_lock(&syslogMutex);
+
+    // Wait for a flushing thread to finish.
+    while(syslogFlushing) {
+        pthread_mutex_unlock(&syslogMutex);
+        sched_yield();
+        pthread_mutex_lock(&syslogMutex);
+    }
+
+    if(syslogFd < 0) {
+        pthread_mutex_unlock(&syslogMutex);
+        return;
+    }
+
+    // One last try at sending what is queued.  Spewing threads will see
+    // syslogFlushing and just queue, or drop, without sending.
+    syslogFlushing = true;
+    bool stalled = false;
+    syslogHead += syslogFlush(syslogFd, syslogHead, syslogTail, &stalled);
+    syslogDropped += syslogTail - syslogHead;
+    syslogHead = syslogTail = 0;
+    syslogFlushing = false;
+
+    close(syslogFd);
+    syslogFd = -1;
+    syslogTee = false;
+
+    pthread_mutex_unlock(&syslogMutex);
+}
+
+
+uint64_t spewSyslogDropped(void) {
+    return syslogDropped;
+}
+
+
+
+
+
+///////////////////////////////////////////////////////////////////////
+// log index
+///////////////////////////////////////////////////////////////////////
+//
+// The index state is only used with the indexed stream locked with
+// flockfile(3), so the stream lock is the index lock too.  Stream offsets
+// are gotten with ftello(3) at the start and end of each block, so other
+// writes to the stream just make blocks longer.
+
+
+static int indexFd = -1;
+static uint32_t indexBlockRecords = SPEW_INDEX_BLOCK_RECORDS;
+// The current block.
+static struct SpewIndexBlock indexBlock;
+
+
+static void indexWrite(const void *data, size_t len) {
+
+    const char *ptr = data;
+
+    while(len) {
+        ssize_t ret = write(indexFd, ptr, len);
+        if(ret < 0 && errno == EINTR)
+            continue;
+        if(ret <= 0) {
+            // We can't spew about it, we are in spew.  The index is
+            // just broken from here on.
+            close(indexFd);
+            indexFd = -1;
+            return;
+        }
+        ptr += ret;
+        len -= ret;
+    }
+}
+
+
+static void indexWriteBlock(FILE *stream) {
+
+    off_t end = ftello(stream);
+    if(end >= 0)
+        indexBlock.length = end - indexBlock.offset;
+    indexWrite(&indexBlock, sizeof(indexBlock));
+    indexBlock.records = 0;
+}
+
+
+// Called with stream locked.
+static void indexRecord(FILE *stream, uint32_t level, pid_t pidIn,
+        size_t tid, const char *file, int line, int64_t usec,
+        const char *buffer) {
+
+    // Like the block's pidMin and pidMax.
+    uint32_t pid = pidIn;
+
+    if(indexFd < 0) {
+        // The index got closed.
+        fputs(buffer, stream);
+        return;
+    }
+
+    struct SpewIndexBlock *b = &indexBlock;
+    uint64_t siteBits[4];
+    spewIndexSiteBits(spewIndexSiteHash(file, line), siteBits);
+
+    if(b->records == 0) {
+        memset(b, 0, sizeof(*b));
+        b->offset = ftello(stream);
+        b->tMin = b->tMax = usec;
+        b->pidMin = b->pidMax = pid;
+        b->tidMin = b->tidMax = tid;
+    } else {
+        if(usec < b->tMin) b->tMin = usec;
+        if(usec > b->tMax) b->tMax = usec;
+        if(pid < b->pidMin) b->pidMin = pid;
+        if(pid > b->pidMax) b->pidMax = pid;
+        if(tid < b->tidMin) b->tidMin = tid;
+        if(tid > b->tidMax) b->tidMax = tid;
+    }
+
+    b->levels |= 1 << level;
+    b->tidBits |= spewIndexTidBit(tid);
+    for(int i = 0; i < 4; ++i)
+        b->siteBits[i] |= siteBits[i];
+    ++b->records;
+
+    fputs(buffer, stream);
+
+    if(b->records >= indexBlockRecords)
+        indexWriteBlock(stream);
+}
+
+
+int spewIndexOpen(FILE *stream, const char *indexPath,
+        uint32_t blockRecords) {
+
+    spewIndexClose();
+
+    // We need to be able to get the stream offset.
+    if(ftello(stream) < 0)
+        return -1;
+
+    int fd = open(indexPath, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if(fd < 0)
+        return -1;
+
+    struct SpewIndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SPEW_INDEX_MAGIC, sizeof(h.magic));
+    h.blockRecords = blockRecords ? blockRecords : SPEW_INDEX_BLOCK_RECORDS;
+    h.blockSize = sizeof(struct SpewIndexBlock);
+
+    flockfile(stream);
+    indexFd = fd;
+    indexBlockRecords = h.blockRecords;
+    indexBlock.records = 0;
+    indexWrite(&h, sizeof(h));
+    if(indexFd >= 0)
+        indexStream = stream;
+    funlockfile(stream);
+
+    return indexFd >= 0 ? 0 : -1;
+}
+
+
+void spewIndexClose(void) {
+
+    FILE *stream = indexStream;
+    if(!stream) return;
+
+    flockfile(stream);
+    if(indexFd >= 0) {
+        if(indexBlock.records)
+            indexWriteBlock(stream);
+        if(indexFd >= 0)
+            close(indexFd);
+        indexFd = -1;
+    }
+    indexStream = 0;
+    funlockfile(stream);
+}
+
+
+
+
+
+///////////////////////////////////////////////////////////////////////
+// assertion tiers
+///////////////////////////////////////////////////////////////////////
+
+
+uint32_t _spewAssertTier = 3;
+uint32_t _spewAssertSampling = 1;
+
+// The list of assert sites that have run.
+static struct SpewAssertSite *_Atomic assertSites = 0;
+
+
+void setAssertTier(int tier) {
+    if(tier > 3) tier = 3;
+    else if(tier < 0) tier = 0;
+    __atomic_store_n(&_spewAssertTier, tier, __ATOMIC_RELAXED);
+}
+
+int getAssertTier(void) {
+    return __atomic_load_n(&_spewAssertTier, __ATOMIC_RELAXED);
+}
+
+void setAssertSampling(uint32_t n) {
+    __atomic_store_n(&_spewAssertSampling, n ? n : 1, __ATOMIC_RELAXED);
+}
+
+
+// Get the assert tier and sampling from the environment once at startup,
+// not in each check like the spew level.
+__attribute__ ( ( constructor ) )
+static void assertEnv(void) {
+#ifdef ASSERT_TIER_ENV
+    char *env = getenv(ASSERT_TIER_ENV);
+    if(env) {
+        // Remove proceeding spaces:
+        while(isspace(*env)) ++env;
+        switch(*env) {
+            case '0':
+            case '1':
+            case '2':
+            case '3':
+                setAssertTier(*env - '0');
+                break;
+            case 'N': // None
+            case 'n': // none
+                setAssertTier(0);
+                break;
+            case 'C': // Cheap
+            case 'c': // cheap
+                setAssertTier(1);
+                break;
+            case 'M': // Moderate
+            case 'm': // moderate
+                setAssertTier(2);
+                break;
+            case 'E': // Expensive
+            case 'e': // expensive
+                setAssertTier(3);
+                break;
+            default:
+                // Not a tier, so leave it as it is.
+                break;
+        }
+    }
+#endif
+#ifdef ASSERT_SAMPLE_ENV
+    char *sample = getenv(ASSERT_SAMPLE_ENV);
+    if(sample && *sample) {
+        char *end;
+        unsigned long n = strtoul(sample, &end, 10);
+        if(end != sample)
+            setAssertSampling(n);
+    }
+#endif
+}
+
+
+uint64_t _spewAssertClock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec)*1000000000 + ts.tv_nsec;
+}
+
+
+void _spewAssertEnd(struct SpewAssertSite *site, uint64_t start) {
+
+    __atomic_add_fetch(&site->runs, 1, __ATOMIC_RELAXED);
+    if(start) {
+        uint64_t nsec = _spewAssertClock() - start;
+        __atomic_add_fetch(&site->timed, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->nsec, nsec, __ATOMIC_RELAXED);
+    }
+
+    if(__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE))
+        return;
+    bool no = false;
+    if(!__atomic_compare_exchange_n(&site->registered, &no, true, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        // Another thread got it.
+        return;
+    site->next = assertSites;
+    while(!atomic_compare_exchange_weak(&assertSites, &site->next, site));
+}
+
+
+void spewStats(FILE *stream) {
+    fprintf(stream, "spew syslog: dropped=%" PRIu64 "\n",
+            (uint64_t) syslogDropped);
+    fprintf(stream, "spew assert tier=%" PRIu32 " sampling=1/%" PRIu32
+            "\n", __atomic_load_n(&_spewAssertTier, __ATOMIC_RELAXED),
+            __atomic_load_n(&_spewAssertSampling, __ATOMIC_RELAXED));
+    for(struct SpewAssertSite *site = assertSites; site; site = site->next) {
+        uint64_t runs = __atomic_load_n(&site->runs, __ATOMIC_RELAXED);
+        uint64_t timed = __atomic_load_n(&site->timed, __ATOMIC_RELAXED);
+        uint64_t nsec = __atomic_load_n(&site->nsec, __ATOMIC_RELAXED);
+        // The time of all the runs from the ones that were timed.
+        double sec = timed ? nsec*1.0e-9*runs/timed : 0.0;
+        fprintf(stream, "spew assert %s:%d %s runs=%" PRIu64
+                " timed=%" PRIu64 " time=%.6fs\n", site->file, site->line,
+                site->expr, runs, timed, sec);
+    }
+}
@@ -8,6 +8,8 @@
  
    DEBUG             -->  DASSERT()
    DEBUG             -->  DZMEM()
+   DEBUG_MODERATE    -->  DASSERT_MODERATE() and DEBUG
+   DEBUG_EXPENSIVE   -->  DASSERT_EXPENSIVE() and DEBUG_MODERATE
 
    SPEW_LEVEL_DEBUG  -->  DSPEW() INFO() NOTICE() WARN() ERROR()
    SPEW_LEVEL_INFO   -->  INFO() NOTICE() WARN() ERROR()
@@ -17,6 +19,11 @@
 
    always on is      --> ASSERT() CHECK() RET_ERROR()
 
+   The async-signal-safe SAFE_DSPEW() SAFE_INFO() SAFE_NOTICE()
+   SAFE_WARN() SAFE_ERROR(), and the hex dump DSPEW_HEX() INFO_HEX()
+   NOTICE_HEX() WARN_HEX() ERROR_HEX() follow the same SPEW_LEVEL_*
+   selectors.
+
    If a macro function is not live it becomes a empty macro with no C code.
 
 
@@ -66,6 +73,18 @@ extern "C" {
 #define SPEW_FILE stderr
 
 
+#ifdef DEBUG_EXPENSIVE
+#  ifndef DEBUG_MODERATE
+#    define DEBUG_MODERATE
+#  endif
+#endif
+#ifdef DEBUG_MODERATE
+#  ifndef DEBUG
+#    define DEBUG
+#  endif
+#endif
+
+
 #ifdef DEBUG
 #  define DZMEM(x,size)  memset((x), 0, (size))
 // Another way to test for bad/freed memory access:
@@ -80,6 +99,27 @@ extern "C" {
 #  pragma GCC diagnostic ignored "-Wformat-zero-length"
 #endif
 
+#ifdef __GNUC__
+// The failure code paths of ASSERT(), CHECK(), and RET_ERROR() are
+// function calls to SPEW_COLD functions, that the compiler puts in
+// .text.unlikely away from the code that calls them.
+#  define SPEW_COLD         __attribute__ ( ( cold, noinline ) )
+#  define SPEW_UNLIKELY(x)  __builtin_expect(!!(x), 0)
+#else
+#  define SPEW_COLD         /* empty macro */
+#  define SPEW_UNLIKELY(x)  (x)
+#endif
+
+// If debug.c is compiled with ASSERT_ACTION_EXIT, then _assert() does
+// not return, so define ASSERT_ACTION_EXIT for the code that includes
+// this too and the compiler may know that.  Otherwise _assert() sleeps
+// waiting for a debugger, which may make it return.
+#if defined(__GNUC__) && defined(ASSERT_ACTION_EXIT)
+#  define ASSERT_NORETURN   __attribute__ ( ( noreturn ) )
+#else
+#  define ASSERT_NORETURN   /* empty macro */
+#endif
+
 
 #ifndef DOXYGEN_RUNNING
 
@@ -99,7 +139,33 @@ void spew(uint32_t level, FILE *stream, int errn, const char *pre,
 
 EXPORT
 void _assert(FILE *stream, const char *file,
-        int lineNum, const char *func);
+        int lineNum, const char *func) ASSERT_NORETURN;
+
+// spew() for failure code paths.
+EXPORT
+void _spewCold(uint32_t level, FILE *stream, int errn, const char *pre,
+        const char *file, int line, const char *func,
+        const char *fmt, ...) SPEW_COLD
+#ifdef __GNUC__
+        __attribute__ ( ( format (printf, 8, 9 ) ) )
+#endif
+        ;
+
+// The spew() and _assert() of a failed ASSERT() or DASSERT().
+EXPORT
+void _assertFail(FILE *stream, int errn, const char *pre,
+        const char *file, int line, const char *func,
+        const char *fmt, ...) SPEW_COLD ASSERT_NORETURN
+#ifdef __GNUC__
+        __attribute__ ( ( format (printf, 7, 8 ) ) )
+#endif
+        ;
+
+// The spew() and _assert() of a failed CHECK().
+EXPORT
+void _checkFail(FILE *stream, int errn, const char *pre, int ret,
+        const char *file, int line, const char *func)
+        SPEW_COLD ASSERT_NORETURN;
 
 
 EXPORT
@@ -113,6 +179,307 @@ EXPORT
 void setSpewLevel(int level);
 
 
+// Formats for spewSyslogOpen() and spewSyslogSetFd().
+//
+//   SPEW_SYSLOG_RFC3164  - "<PRI>Mmm dd hh:mm:ss ident[pid]: msg" for
+//                          the local syslog socket /dev/log
+//   SPEW_SYSLOG_JOURNALD - journald native protocol for
+//                          /run/systemd/journal/socket
+//
+// Or in SPEW_SYSLOG_TEE to keep spewing to the stream too.
+#define SPEW_SYSLOG_RFC3164   0
+#define SPEW_SYSLOG_JOURNALD  1
+#define SPEW_SYSLOG_TEE       (1 << 8)
+
+// Send spew to a local unix datagram socket at path instead of (or with
+// SPEW_SYSLOG_TEE in addition to) the stream.  If path is 0 the default
+// socket path for the format is used.  ident is the syslog tag; if ident
+// is 0 program_invocation_short_name is used.  Returns 0 on success, or
+// -1 with errno set.
+EXPORT
+int spewSyslogOpen(const char *path, int format, const char *ident);
+
+// Like spewSyslogOpen() but with an already connected datagram socket,
+// like one end of a socketpair(2).  The fd is closed by
+// spewSyslogClose().
+EXPORT
+int spewSyslogSetFd(int fd, int format, const char *ident);
+
+// INFO and DEBUG records are queued and sent in batches.  Send any
+// that are queued now, like before a long wait.  Queued records are
+// also sent at exit(3).
+EXPORT
+void spewSyslogFlush(void);
+
+// Send any queued records and close the socket.
+EXPORT
+void spewSyslogClose(void);
+
+// Number of spew records dropped because the syslog daemon was not
+// keeping up.
+EXPORT
+uint64_t spewSyslogDropped(void);
+
+
+// Write a sidecar index file at indexPath for the spew records that go
+// to stream, one index block for every blockRecords records (0 for the
+// default).  stream should be a regular file that is only written to by
+// spew; like the file from freopen(path, "a", stderr).  Records to the
+// indexed stream get a ":t=SEC.USEC" time stamp after the thread id.
+// The spewQuery program uses the index to read just the blocks of the
+// log that may have records that it is looking for.  Returns 0 on
+// success, or -1 with errno set.
+EXPORT
+int spewIndexOpen(FILE *stream, const char *indexPath,
+        uint32_t blockRecords);
+
+// Write the last partial index block and close the index file.
+EXPORT
+void spewIndexClose(void);
+
+
+#define SPEW_INDEX_MAGIC     "SPEWIDX1"
+#define SPEW_INDEX_BLOCK_RECORDS  256
+
+// The index file is a struct SpewIndexHeader followed by struct
+// SpewIndexBlock for each block, in host byte order.
+struct SpewIndexHeader {
+    char magic[8];  // SPEW_INDEX_MAGIC without the '\0'
+    uint32_t blockRecords;
+    uint32_t blockSize; // sizeof(struct SpewIndexBlock)
+};
+
+struct SpewIndexBlock {
+    // The block is log file bytes [offset, offset + length).
+    uint64_t offset;
+    uint64_t length;
+    // Microseconds since the Epoch.
+    int64_t tMin, tMax;
+    uint32_t records;
+    // Bit (1 << level) is set for each spew level in the block.
+    uint32_t levels;
+    uint32_t pidMin, pidMax;
+    uint32_t tidMin, tidMax;
+    // Bloom filter bits of the thread ids and call sites (file:line)
+    // in the block.  See spewIndexSiteHash().
+    uint64_t tidBits;
+    uint64_t siteBits[4];
+};
+
+// FNV-1a hash of file and line.  file is as in the spew, __BASE_FILE__.
+static inline uint32_t spewIndexSiteHash(const char *file, int line) {
+    uint32_t h = 2166136261u;
+    while(*file) {
+        h ^= (uint8_t) *file++;
+        h *= 16777619u;
+    }
+    for(int i = 0; i < 4; ++i) {
+        h ^= (uint8_t) (line >> (8*i));
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static inline uint64_t spewIndexTidBit(uint32_t tid) {
+    return ((uint64_t) 1) << ((tid * 2654435761u) >> 26);
+}
+
+// Two bits in the 256 bit siteBits from a spewIndexSiteHash().
+static inline void spewIndexSiteBits(uint32_t hash, uint64_t bits[4]) {
+    bits[0] = bits[1] = bits[2] = bits[3] = 0;
+    bits[(hash >> 6) & 3] |= ((uint64_t) 1) << (hash & 63);
+    bits[(hash >> 14) & 3] |= ((uint64_t) 1) << ((hash >> 8) & 63);
+}
+
+
+#define SPEW_CONTEXT_LEN    256
+#define SPEW_CONTEXT_DEPTH  16
+
+// Thread context tags that are added to all spew from the thread, after
+// the function name.  The tags are rendered to text once when they are
+// pushed, so spew just copies them.  A zeroed struct SpewContext is an
+// empty context.
+struct SpewContext {
+    uint32_t len; // strlen(tags)
+    uint32_t depth;
+    // len before each push.
+    uint16_t pushLen[SPEW_CONTEXT_DEPTH];
+    char tags[SPEW_CONTEXT_LEN];
+};
+
+// Push the tag "key=value " to the current thread context.  The value
+// is made from printf(3) like fmt.  Returns 0 on success, or -1 if the
+// tag did not fit; in which case it's pushed as an empty tag so that
+// pushes and pops still pair up.
+EXPORT
+int spewContextPush(const char *key, const char *fmt, ...)
+#ifdef __GNUC__
+        __attribute__ ( ( format (printf, 2, 3 ) ) )
+#endif
+        ;
+
+// Pop the last pushed tag from the current thread context.
+EXPORT
+void spewContextPop(void);
+
+// Make ctx the current thread context and return the one it replaces,
+// so that a thread that switches between tasks, like coroutines, can
+// keep a context for each task.  ctx = 0 is the thread's own context.
+EXPORT
+struct SpewContext *spewContextSwap(struct SpewContext *ctx);
+
+
+// spew() the len bytes at ptr in hexdump -C layout, after the fmt
+// message.  Large dumps are spewed in more than one record, each with
+// the fmt message and which part it is, so nothing gets cut off at the
+// spew buffer length.  Use the DSPEW_HEX() to ERROR_HEX() macros.
+EXPORT
+void spewHex(uint32_t level, FILE *stream, int errn, const char *pre,
+        const char *file, int line, const char *func,
+        const void *ptr, size_t len, const char *fmt, ...)
+#ifdef __GNUC__
+        __attribute__ ( ( format (printf, 10, 11 ) ) )
+#endif
+        ;
+
+// The longest hexdump -C line from spewHexFormat(), with 16 hex digit
+// offsets.
+#define SPEW_HEX_LINE_MAX  87
+
+// Write hexdump -C lines for the len bytes at ptr to out, with the
+// offsets starting at offset.  Not the last line with just the ending
+// offset.  out must have room for SPEW_HEX_LINE_MAX bytes for each 16
+// bytes of len.  Returns the number of chars written; out is not '\0'
+// terminated.  The hex encoding uses SSSE3 or AVX2 if the CPU has them.
+EXPORT
+size_t spewHexFormat(char *out, const void *ptr, size_t len,
+        size_t offset);
+
+
+// An async-signal-safe spew() for signal handlers and for assertAction
+// when crashing.  It formats with a small reentrant printf(3) that does
+// %d %i %u %o %x %X %p %s %c and %% with the usual length modifiers,
+// flags, field widths and precisions; no floating point, which is
+// written as just "%f" and the like.  The rest of the format after any
+// other conversion is written as is.  It does not use stdio, malloc(3),
+// getenv(3) or strerror(3), so errno is spewed as just a number, and it
+// write(2)s straight to fd, not to the syslog sink or a spew index.
+// fd < 0 spews nothing.
+EXPORT
+void safeSpew(uint32_t level, int fd, int errn, const char *pre,
+        const char *file, int line, const char *func,
+        const char *fmt, ...)
+#ifdef __GNUC__
+        __attribute__ ( ( format (printf, 8, 9 ) ) )
+#endif
+        ;
+
+// Spew the call stack from the calling function as raw addresses with
+// the object file and offset of each, from the load map that was
+// cached by spewCrashCatch() or spewLoadMapRefresh().  That's
+// enough to get the function names and line numbers later with
+// addr2line(1).  It's async-signal-safe after spewCrashCatch() has
+// been called.
+EXPORT
+void safeSpewBacktrace(int fd);
+
+// Catch SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT and spew the signal
+// and a safeSpewBacktrace() to stderr, and then die by the signal.
+// For the thread that calls this, the handler runs on an alternate
+// signal stack so it works with stack overflows too.  Returns 0 on
+// success, or -1 with errno set.
+EXPORT
+int spewCrashCatch(void);
+
+// Cache the load map again, after dlopen(3) or dlclose(3), so the
+// backtrace offsets are right for newly loaded objects.
+EXPORT
+void spewLoadMapRefresh(void);
+
+
+// Assertion tiers.  The DASSERT() tier is cheap, DASSERT_MODERATE() is
+// moderate, and DASSERT_EXPENSIVE() is expensive.  At compile time the
+// tiers are selected with DEBUG, DEBUG_MODERATE, and DEBUG_EXPENSIVE.
+// At run-time checks in tiers above the assert tier are not run; and
+// only 1 in N calls of each DASSERT_EXPENSIVE() in each thread is run,
+// where N is the assert sampling.  The ASSERT_TIER and ASSERT_SAMPLE
+// environment variables set them at startup; ASSERT_TIER may be the
+// number or the name, and is ignored if it's neither.
+//
+//   tier:  0 = none, 1 = cheap, 2 = moderate, 3 = expensive (default)
+//
+EXPORT
+void setAssertTier(int tier);
+
+EXPORT
+int getAssertTier(void);
+
+// Run 1 in n DASSERT_EXPENSIVE() calls per site and thread.  0 and 1
+// run them all.
+EXPORT
+void setAssertSampling(uint32_t n);
+
+#ifndef DOXYGEN_RUNNING
+
+// Each DASSERT_MODERATE() and DASSERT_EXPENSIVE() has one of these, and
+// the ones that have run are in a list that spewStats() prints.
+struct SpewAssertSite {
+    const char *file;
+    int line;
+    const char *expr; // like "DASSERT_EXPENSIVE(x)"
+    const char *pre;  // like "DASSERT_EXPENSIVE(x) failed:"
+    uint32_t tier;
+    bool registered;
+    struct SpewAssertSite *next;
+    // Number of checks run, and how many of those were timed and the
+    // nanoseconds spent in them.
+    uint64_t runs;
+    uint64_t timed;
+    uint64_t nsec;
+};
+
+// Time 1 in this many runs of each DASSERT_MODERATE() per site and
+// thread, so that they don't cost two clock_gettime(2) calls each.
+// DASSERT_EXPENSIVE() runs are all timed.
+#ifndef SPEW_ASSERT_TIME_SAMPLE
+#  define SPEW_ASSERT_TIME_SAMPLE  64
+#endif
+
+// Set in any thread, so read and written with relaxed __atomic builtins
+// like spewLevel is atomic.
+EXPORT
+uint32_t _spewAssertTier;
+EXPORT
+uint32_t _spewAssertSampling;
+
+EXPORT
+uint64_t _spewAssertClock(void);
+
+// Counts the run, and times it if start is not 0.
+EXPORT
+void _spewAssertEnd(struct SpewAssertSite *site, uint64_t start);
+
+// Returns true if the check at site should run this time.
+static inline bool _spewAssertBegin(const struct SpewAssertSite *site,
+        uint32_t *count) {
+    if(__atomic_load_n(&_spewAssertTier, __ATOMIC_RELAXED) < site->tier)
+        return false;
+    if(site->tier >= 3) {
+        uint32_t n = __atomic_load_n(&_spewAssertSampling, __ATOMIC_RELAXED);
+        if(n > 1 && (++*count) % n)
+            return false;
+    }
+    return true;
+}
+
+#endif // #ifndef DOXYGEN_RUNNING
+
+
+// Print spew statistics, like dropped syslog records, to stream.
+EXPORT
+void spewStats(FILE *stream);
+
+
 #endif // #ifndef DOXYGEN_RUNNING
 
 // This CPP macro function CHECK() is just so we can call most pthread_*()
@@ -135,10 +502,15 @@ void setSpewLevel(int level);
 // number of failure code paths.  If malloc(10) fails we call ASSERT.
 // If pthread_mutex_lock() fails we call ASSERT. ...
 //
+// The code that is inlined is just the compare and branch to the
+// _checkFail() call.
+//
 #define CHECK(x) \
     do { \
         int ret = (x); \
-        ASSERT(ret == 0, #x "=%d FAILED", ret); \
+        if(SPEW_UNLIKELY(ret != 0)) \
+            _checkFail(SPEW_FILE, errno, "CHECK(" #x ") failed:", ret, \
+                    __BASE_FILE__, __LINE__, __func__); \
     } while(0)
 
 
@@ -151,8 +523,8 @@ void setSpewLevel(int level);
 //
 #define RET_ERROR(val, ret, ...) \
     do {\
-        if(!((bool) (val))) {\
-            ERROR("" __VA_ARGS__);\
+        if(SPEW_UNLIKELY(!((bool) (val)))) {\
+            _ERROR_COLD("" __VA_ARGS__);\
             return ret;\
         }\
     }\
@@ -164,15 +536,21 @@ void setSpewLevel(int level);
      spew(level, stream, errn, pre, __BASE_FILE__, __LINE__,\
         __func__, fmt, ##__VA_ARGS__)
 
+#  define _SPEW_COLD(level, stream, errn, pre, fmt, ... )\
+     _spewCold(level, stream, errn, pre, __BASE_FILE__, __LINE__,\
+        __func__, fmt, ##__VA_ARGS__)
+
 
 // It's nice to see that it is ASSERT() or DASSERT() as it is in the code;
 // hence we pass fname as ASSERT or DASSERT.
+//
+// The spew argument setup and the _assert() call are all in the
+// _assertFail() call, on the unlikely branch.
 #  define DO_ASSERT(fname, val, ...) \
     do {\
-        if(!((bool) (val))) {\
-            _SPEW(1, SPEW_FILE, errno, #fname"("#val") failed:", "" __VA_ARGS__);\
-            _assert(SPEW_FILE, __BASE_FILE__, __LINE__, __func__);\
-        }\
+        if(SPEW_UNLIKELY(!((bool) (val))))\
+            _assertFail(SPEW_FILE, errno, #fname"("#val") failed:",\
+                    __BASE_FILE__, __LINE__, __func__, "" __VA_ARGS__);\
     }\
     while(0)
 
@@ -221,16 +599,67 @@ void setSpewLevel(int level);
 
 
 
+// DASSERT() is cheap, so we check the run-time assert tier after it
+// fails.
 #ifdef DEBUG
-#  define DASSERT(val, ...)  DO_ASSERT(DASSERT, val, ##__VA_ARGS__)
+#  define DASSERT(val, ...) \
+    do {\
+        if(SPEW_UNLIKELY(!((bool) (val))) &&\
+                __atomic_load_n(&_spewAssertTier, __ATOMIC_RELAXED) >= 1)\
+            _assertFail(SPEW_FILE, errno, "DASSERT("#val") failed:",\
+                    __BASE_FILE__, __LINE__, __func__, "" __VA_ARGS__);\
+    }\
+    while(0)
 #else
 #  define DASSERT(val, ...)  /*empty macro*/
 #endif
 
+// val is not evaluated unless the tier is on and the sampling picks
+// this call.  Every run is counted for the site, and the time spent in
+// val is sampled.
+#  define DO_TIER_ASSERT(fname, tierIn, val, ...) \
+    do {\
+        static struct SpewAssertSite _site = {\
+            .file = __BASE_FILE__,\
+            .line = __LINE__,\
+            .expr = #fname"("#val")",\
+            .pre = #fname"("#val") failed:",\
+            .tier = tierIn\
+        };\
+        static __thread uint32_t _count = 0, _runs = 0;\
+        if(_spewAssertBegin(&_site, &_count)) {\
+            uint64_t _start = (tierIn < 3 &&\
+                    _runs++ % SPEW_ASSERT_TIME_SAMPLE) ?\
+                0 : _spewAssertClock();\
+            bool _ok = (bool) (val);\
+            _spewAssertEnd(&_site, _start);\
+            if(SPEW_UNLIKELY(!_ok))\
+                _assertFail(SPEW_FILE, errno, _site.pre,\
+                        __BASE_FILE__, __LINE__, __func__, "" __VA_ARGS__);\
+        }\
+    }\
+    while(0)
+
+#ifdef DEBUG_MODERATE
+#  define DASSERT_MODERATE(val, ...) \
+    DO_TIER_ASSERT(DASSERT_MODERATE, 2, val, ##__VA_ARGS__)
+#else
+#  define DASSERT_MODERATE(val, ...)  /*empty macro*/
+#endif
+
+#ifdef DEBUG_EXPENSIVE
+#  define DASSERT_EXPENSIVE(val, ...) \
+    DO_TIER_ASSERT(DASSERT_EXPENSIVE, 3, val, ##__VA_ARGS__)
+#else
+#  define DASSERT_EXPENSIVE(val, ...)  /*empty macro*/
+#endif
+
 #ifdef SPEW_LEVEL_NONE
 #define ERROR(...) _SPEW(0, 0/*no spew stream*/, errno, "ERROR:", "" __VA_ARGS__)
+#define _ERROR_COLD(...) _SPEW_COLD(0, 0/*no spew stream*/, errno, "ERROR:", "" __VA_ARGS__)
 #else
 #define ERROR(...) _SPEW(1, SPEW_FILE, errno, "ERROR:", "" __VA_ARGS__)
+#define _ERROR_COLD(...) _SPEW_COLD(1, SPEW_FILE, errno, "ERROR:", "" __VA_ARGS__)
 #endif
 
 #ifdef SPEW_LEVEL_WARN
@@ -257,6 +686,86 @@ void setSpewLevel(int level);
 #  define DSPEW(...) /*empty macro*/
 #endif
 
+
+// Hex dumps of the len bytes at ptr, with the same spew levels as
+// ERROR(), WARN(), NOTICE(), INFO(), and DSPEW().  Like:
+//
+//   DSPEW_HEX(packet, packetLen, "got packet from %s", peer);
+
+#  define _SPEW_HEX(level, stream, errn, pre, ptr, len, fmt, ... )\
+     spewHex(level, stream, errn, pre, __BASE_FILE__, __LINE__,\
+        __func__, ptr, len, fmt, ##__VA_ARGS__)
+
+#ifdef SPEW_LEVEL_NONE
+#  define ERROR_HEX(ptr, len, ...) _SPEW_HEX(0, 0/*no spew stream*/, errno, "ERROR:", ptr, len, "" __VA_ARGS__)
+#else
+#  define ERROR_HEX(ptr, len, ...) _SPEW_HEX(1, SPEW_FILE, errno, "ERROR:", ptr, len, "" __VA_ARGS__)
+#endif
+
+#ifdef SPEW_LEVEL_WARN
+#  define WARN_HEX(ptr, len, ...) _SPEW_HEX(2, SPEW_FILE, errno, "WARN:", ptr, len, "" __VA_ARGS__)
+#else
+#  define WARN_HEX(ptr, len, ...) /*empty macro*/
+#endif
+
+#ifdef SPEW_LEVEL_NOTICE
+#  define NOTICE_HEX(ptr, len, ...) _SPEW_HEX(3, SPEW_FILE, errno, "NOTICE:", ptr, len, "" __VA_ARGS__)
+#else
+#  define NOTICE_HEX(ptr, len, ...) /*empty macro*/
+#endif
+
+#ifdef SPEW_LEVEL_INFO
+#  define INFO_HEX(ptr, len, ...) _SPEW_HEX(4, SPEW_FILE, 0, "INFO:", ptr, len, "" __VA_ARGS__)
+#else
+#  define INFO_HEX(ptr, len, ...) /*empty macro*/
+#endif
+
+#ifdef SPEW_LEVEL_DEBUG
+#  define DSPEW_HEX(ptr, len, ...) _SPEW_HEX(5, SPEW_FILE, 0, "DEBUG:", ptr, len, "" __VA_ARGS__)
+#else
+#  define DSPEW_HEX(ptr, len, ...) /*empty macro*/
+#endif
+
+
+// The async-signal-safe versions of ERROR(), WARN(), NOTICE(), INFO(),
+// and DSPEW().  See safeSpew().
+
+#  define _SAFE_SPEW(level, fd, errn, pre, fmt, ... )\
+     safeSpew(level, fd, errn, pre, __BASE_FILE__, __LINE__,\
+        __func__, fmt, ##__VA_ARGS__)
+
+#define SPEW_FD  2 // STDERR_FILENO
+
+#ifdef SPEW_LEVEL_NONE
+#  define SAFE_ERROR(...) _SAFE_SPEW(0, -1/*no spew fd*/, errno, "ERROR:", "" __VA_ARGS__)
+#else
+#  define SAFE_ERROR(...) _SAFE_SPEW(1, SPEW_FD, errno, "ERROR:", "" __VA_ARGS__)
+#endif
+
+#ifdef SPEW_LEVEL_WARN
+#  define SAFE_WARN(...) _SAFE_SPEW(2, SPEW_FD, errno, "WARN:", "" __VA_ARGS__)
+#else
+#  define SAFE_WARN(...) /*empty macro*/
+#endif
+
+#ifdef SPEW_LEVEL_NOTICE
+#  define SAFE_NOTICE(...) _SAFE_SPEW(3, SPEW_FD, errno, "NOTICE:", "" __VA_ARGS__)
+#else
+#  define SAFE_NOTICE(...) /*empty macro*/
+#endif
+
+#ifdef SPEW_LEVEL_INFO
+#  define SAFE_INFO(...) _SAFE_SPEW(4, SPEW_FD, 0, "INFO:", "" __VA_ARGS__)
+#else
+#  define SAFE_INFO(...) /*empty macro*/
+#endif
+
+#ifdef SPEW_LEVEL_DEBUG
+#  define SAFE_DSPEW(...) _SAFE_SPEW(5, SPEW_FD, 0, "DEBUG:", "" __VA_ARGS__)
+#else
+#  define SAFE_DSPEW(...) /*empty macro*/
+#endif
+
 /** @} */
 
 #ifdef __cplusplus
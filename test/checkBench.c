@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <time.h>
+#include <elf.h>
+#include <link.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../debug.h"
+
+// Compares a kernel full of CHECK() and ASSERT() calls with the same
+// kernel using the old form of the macros, that had the spew() argument
+// setup and the _assert() call inlined with no branch hint.  Prints
+// the hot loop throughput and the function sizes, from the symbol table
+// of /proc/self/exe.  Build with optimization to make it mean anything.
+
+
+#define OLD_ASSERT(val, ...) \
+    do {\
+        if(!((bool) (val))) {\
+            _SPEW(1, SPEW_FILE, errno, "ASSERT("#val") failed:", "" __VA_ARGS__);\
+            _assert(SPEW_FILE, __BASE_FILE__, __LINE__, __func__);\
+        }\
+    }\
+    while(0)
+
+#define OLD_CHECK(x) \
+    do { \
+        int ret = (x); \
+        OLD_ASSERT(ret == 0, #x "=%d FAILED", ret); \
+    } while(0)
+
+
+#define LEN  4096
+#define LOOPS  20000
+
+static uint32_t a[LEN];
+
+
+// The values in a[] are all less than LEN so no CHECK() or ASSERT()
+// fails.
+#define KERNEL(name, CHECK, ASSERT) \
+__attribute__ ( ( noinline ) ) \
+uint64_t name(const uint32_t *a, size_t n) { \
+    uint64_t sum = 0; \
+    for(size_t i = 0; i < n; ++i) { \
+        uint32_t x = a[i]; \
+        CHECK(x >> 20); \
+        CHECK(x == 0xFFFFFFFF); \
+        CHECK((x & 0xFF000000) != 0); \
+        CHECK(x > LEN); \
+        ASSERT(x < LEN, "x=%u i=%zu", x, i); \
+        ASSERT(x + i >= i, "x=%u i=%zu sum=%" PRIu64, x, i, sum); \
+        sum += x; \
+        CHECK(sum >> 60); \
+        ASSERT(sum < (((uint64_t) 1) << 60), "sum=%" PRIu64, sum); \
+        sum ^= x << 3; \
+        CHECK(x == LEN + 2); \
+        ASSERT(x != LEN + 1, "x=%u", x); \
+    } \
+    return sum; \
+}
+
+KERNEL(newKernel, CHECK, ASSERT)
+KERNEL(oldKernel, OLD_CHECK, OLD_ASSERT)
+
+
+// Returns the size of the symbol name in /proc/self/exe, or 0 if not
+// found.
+static size_t SymbolSize(const char *name) {
+
+    int fd = open("/proc/self/exe", O_RDONLY);
+    ASSERT(fd >= 0);
+    struct stat st;
+    ASSERT(fstat(fd, &st) == 0);
+    const uint8_t *elf = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ASSERT(elf != MAP_FAILED);
+    close(fd);
+
+    const ElfW(Ehdr) *eh = (const void *) elf;
+    const ElfW(Shdr) *sh = (const void *) (elf + eh->e_shoff);
+    size_t size = 0;
+
+    for(int i = 0; i < eh->e_shnum; ++i) {
+        if(sh[i].sh_type != SHT_SYMTAB) continue;
+        const ElfW(Sym) *sym = (const void *) (elf + sh[i].sh_offset);
+        const char *str = (const char *) elf + sh[sh[i].sh_link].sh_offset;
+        size_t num = sh[i].sh_size/sizeof(*sym);
+        for(size_t j = 0; j < num; ++j)
+            if(strcmp(str + sym[j].st_name, name) == 0) {
+                size = sym[j].st_size;
+                break;
+            }
+    }
+
+    munmap((void *) elf, st.st_size);
+    return size;
+}
+
+
+static double Run(uint64_t (*kernel)(const uint32_t *, size_t),
+        uint64_t *sum) {
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(int i = 0; i < LOOPS; ++i)
+        *sum += kernel(a, LEN);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)*1.0e-9;
+    // Mega elements per second.
+    return LOOPS*((double) LEN)/sec/1.0e6;
+}
+
+
+static void Report(const char *name,
+        uint64_t (*kernel)(const uint32_t *, size_t)) {
+
+    char cold[64];
+    snprintf(cold, sizeof(cold), "%s.cold", name);
+    uint64_t sum = 0;
+    // Warm up.
+    Run(kernel, &sum);
+    double rate = Run(kernel, &sum);
+    printf("%-10s %8.1f M elements/s   hot size %5zu bytes   "
+            "cold size %5zu bytes   (sum=%" PRIu64 ")\n",
+            name, rate, SymbolSize(name), SymbolSize(cold), sum);
+}
+
+
+int main(void) {
+
+    srand(1);
+    for(int i = 0; i < LEN; ++i)
+        a[i] = rand() % LEN;
+
+    Report("oldKernel", oldKernel);
+    Report("newKernel", newKernel);
+    Report("oldKernel", oldKernel);
+    Report("newKernel", newKernel);
+
+    return 0;
+}
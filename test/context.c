@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../debug.h"
+
+
+// Two tasks that one thread switches between, like coroutines.
+static struct SpewContext task[2];
+
+
+int main(void) {
+
+    // The thread's own context.
+    struct SpewContext *thread = spewContextSwap(0);
+    ASSERT(thread);
+    ASSERT(spewContextSwap(0) == thread);
+
+    INFO("no context");
+    ASSERT(thread->len == 0 && thread->tags[0] == '\0');
+
+    ASSERT(spewContextPush("req", "%d", 1234) == 0);
+    ASSERT(spewContextPush("tenant", "%s", "acme") == 0);
+    ASSERT(strcmp(thread->tags, "req=1234 tenant=acme ") == 0,
+            "tags=\"%s\"", thread->tags);
+    INFO("with req and tenant");
+    ERROR("with req and tenant");
+
+    spewContextPop();
+    ASSERT(strcmp(thread->tags, "req=1234 ") == 0);
+    INFO("with just req");
+    spewContextPop();
+    ASSERT(thread->len == 0 && thread->tags[0] == '\0');
+    INFO("no context");
+
+    // Pops with nothing pushed do nothing.
+    spewContextPop();
+    ASSERT(thread->depth == 0 && thread->len == 0);
+
+    for(int i = 0; i < 2; ++i) {
+        struct SpewContext *old = spewContextSwap(&task[i]);
+        ASSERT(old == thread);
+        ASSERT(spewContextPush("task", "%d", i) == 0);
+        ASSERT(spewContextSwap(old) == &task[i]);
+    }
+    ASSERT(strcmp(task[0].tags, "task=0 ") == 0);
+    ASSERT(strcmp(task[1].tags, "task=1 ") == 0);
+    ASSERT(thread->len == 0);
+
+    for(int i = 0; i < 4; ++i) {
+        struct SpewContext *old = spewContextSwap(&task[i%2]);
+        INFO("in task %d", i%2);
+        ASSERT(spewContextSwap(old) == &task[i%2]);
+    }
+    INFO("no context");
+
+    // Too many pushes return -1 and still pair up with pops.
+    for(int i = 0; i < SPEW_CONTEXT_DEPTH + 4; ++i)
+        ASSERT(spewContextPush("d", "%d", i) ==
+                (i < SPEW_CONTEXT_DEPTH ? 0 : -1), "i=%d", i);
+    ASSERT(thread->depth == SPEW_CONTEXT_DEPTH + 4);
+    for(int i = 0; i < SPEW_CONTEXT_DEPTH + 3; ++i)
+        spewContextPop();
+    ASSERT(strcmp(thread->tags, "d=0 ") == 0, "tags=\"%s\"", thread->tags);
+    ASSERT(thread->len == 4 && thread->depth == 1);
+    INFO("with just d=0");
+    spewContextPop();
+    ASSERT(thread->len == 0 && thread->tags[0] == '\0' &&
+            thread->depth == 0);
+    INFO("no context");
+
+    // A tag too long to fit is pushed empty.
+    char big[SPEW_CONTEXT_LEN];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    ASSERT(spewContextPush("req", "%d", 1) == 0);
+    ASSERT(spewContextPush("big", "%s", big) == -1);
+    ASSERT(strcmp(thread->tags, "req=1 ") == 0, "tags=\"%s\"",
+            thread->tags);
+    ASSERT(thread->depth == 2);
+    spewContextPop();
+    ASSERT(strcmp(thread->tags, "req=1 ") == 0);
+    spewContextPop();
+    ASSERT(thread->len == 0 && thread->tags[0] == '\0');
+
+    INFO("context test success");
+
+    return 0;
+}
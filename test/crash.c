@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "../debug.h"
+
+// Checks what safeSpew() formats, spews with the async-signal-safe spew
+// functions from a signal handler and then crashes with spewCrashCatch()
+// catching it.  This is expected to die with SIGSEGV after spewing a
+// backtrace like:
+//
+//   CRASH: pid=... caught SIGSEGV (11) code=1 addr=(nil)
+//   backtrace pid=...
+//     #0  0x55d0c4a4b2a9 /path/to/crash 0x12a8
+//
+// Then run: addr2line -f -i -e /path/to/crash 0x12a8
+
+
+static int pipeFd[2];
+
+// Check that safeSpew() formats fmt as expect, by spewing into a pipe and
+// reading the line back.
+#define CHECK_FORMAT(expect, fmt, ...)\
+    do {\
+        safeSpew(4, pipeFd[1], 0, "INFO:", "f", 1, "g", fmt, ##__VA_ARGS__);\
+        char _buf[1024];\
+        ssize_t _n = read(pipeFd[0], _buf, sizeof(_buf) - 1);\
+        ASSERT(_n > 0 && _buf[_n - 1] == '\n');\
+        _buf[_n - 1] = '\0';\
+        const char *_got = strstr(_buf, "g(): ");\
+        ASSERT(_got && strcmp(_got + 5, expect) == 0,\
+                "format \"%s\" got \"%s\" not \"%s\"",\
+                fmt, _buf, expect);\
+    } while(0)
+
+
+static void checkFormats(void) {
+
+    ASSERT(pipe(pipeFd) == 0);
+
+    CHECK_FORMAT("plain", "plain");
+    CHECK_FORMAT("-42 4000000000 beef BEEF 777 % c",
+            "%d %u %x %X %o %% %c", -42, 4000000000u, 0xbeef, 0xBEEF,
+            0777, 'c');
+    CHECK_FORMAT("123 -1234567890 -1234567890123 -1 255",
+            "%zu %ld %lld %hd %hhu", (size_t) 123, -1234567890L,
+            -1234567890123LL, (short) -1, (unsigned char) 255);
+    CHECK_FORMAT("0x1234", "%p", (void *) 0x1234);
+
+    // Widths
+    CHECK_FORMAT("|    1|2    |-0003|  -42|-42  |", "|%5d|%-5d|%05d|%5d|%-5d|",
+            1, 2, -3, -42, -42);
+    CHECK_FORMAT("|   ab|ab   |", "|%*s|%*s|", 5, "ab", -5, "ab");
+    CHECK_FORMAT("|  7|", "|%*d|", 3, 7);
+
+    // Precisions
+    CHECK_FORMAT("[abc] then next and 7", "[%.*s] then %s and %d",
+            3, "abcdef", "next", 7);
+    CHECK_FORMAT("[abc]", "[%.3s]", "abcdef");
+    CHECK_FORMAT("[ab]", "[%.5s]", "ab");
+    CHECK_FORMAT("[]", "[%.0s]", "ab");
+    CHECK_FORMAT("[  abc]", "[%5.3s]", "abcdef");
+    CHECK_FORMAT("[abc  ]", "[%-5.3s]", "abcdef");
+    CHECK_FORMAT("[   07] [  -07] [00042] []", "[%5.2d] [%5.2d] [%.5d] [%.0d]",
+            7, -7, 42, 0);
+    CHECK_FORMAT("[   ff]", "[%5.2x]", 0xff);
+
+    // Not formatted, but the arguments after still line up.
+    CHECK_FORMAT("%f %e and 7 %g next", "%f %e and %d %g %s", 1.5, 2.5, 7,
+            3.5, "next");
+    CHECK_FORMAT("%f 9", "%Lf %d", (long double) 1.5, 9);
+
+    // Anything we don't know stops the formatting.
+    CHECK_FORMAT("1 %m then %d %s", "%d %m then %d %s", 1, 2, "x");
+
+    close(pipeFd[0]);
+    close(pipeFd[1]);
+}
+
+
+static void catcher(int sig) {
+
+    int saveErrno = errno;
+    errno = EINTR;
+    SAFE_ERROR("catch signal %d", sig);
+    SAFE_INFO("%d %5d|%-5d|%05d %u %x %X %p %s %c %% %zu %ld %lld %s",
+            -42, 1, 2, -3, 4000000000u, 0xbeef, 0xBEEF, (void *) catcher,
+            "string", 'c', (size_t) 123, -1234567890L,
+            -1234567890123LL, (char *) 0);
+    SAFE_DSPEW();
+    errno = saveErrno;
+}
+
+
+__attribute__ ( ( noinline ) )
+static void crash(int *p) {
+
+    DSPEW("about to write to %p", p);
+    *p = 1;
+}
+
+
+int main(int argc, char **argv) {
+
+    checkFormats();
+
+    signal(SIGUSR1, catcher);
+    raise(SIGUSR1);
+
+    spewContextPush("ctx", "crash");
+    SAFE_NOTICE("with context");
+    spewContextPop();
+
+    ASSERT(spewCrashCatch() == 0);
+    safeSpewBacktrace(SPEW_FD);
+
+    // Keep the compiler from knowing it's 0.
+    crash((int *) (uintptr_t) (argc - 1));
+
+    return 0;
+}
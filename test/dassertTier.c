@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../debug.h"
+
+// A linked list with a full consistency walk as the expensive invariant.
+
+
+struct Node {
+    struct Node *next;
+    int value;
+};
+
+static struct Node *list = 0;
+static int listLen = 0;
+
+
+#ifdef DEBUG_EXPENSIVE
+static bool ListIsConsistent(void) {
+    int n = 0;
+    for(struct Node *node = list; node; node = node->next)
+        ++n;
+    return n == listLen;
+}
+#endif
+
+
+static void Push(int value) {
+
+    struct Node *node = malloc(sizeof(*node));
+    ASSERT(node, "malloc() failed");
+    node->value = value;
+    node->next = list;
+    list = node;
+    ++listLen;
+
+    DASSERT(listLen > 0);
+    DASSERT_MODERATE(list->next || listLen == 1);
+    DASSERT_EXPENSIVE(ListIsConsistent(), "listLen=%d", listLen);
+}
+
+
+int main(void) {
+
+    setAssertSampling(100);
+    for(int i = 0; i < 10000; ++i)
+        Push(i);
+    spewStats(stderr);
+
+    // A failing expensive check that does not run.
+    setAssertTier(2);
+    DASSERT_EXPENSIVE(0);
+
+    // A failing cheap check that does not assert.
+    setAssertTier(0);
+    DASSERT(0);
+
+    INFO("Did not call DASSERT(0) or DASSERT_EXPENSIVE(0)");
+
+    // This should assert, if compiled with DEBUG_MODERATE.
+    setAssertTier(2);
+    DASSERT_MODERATE(0);
+
+    return 0;
+}
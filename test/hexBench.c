@@ -0,0 +1,113 @@
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../debug.h"
+
+// Checks spewHexFormat() against a plain snprintf(3) hexdump -C, and
+// compares the throughput of spewHexFormat() and DSPEW_HEX() with
+// the snprintf("%02x") per byte loop that we used to write.
+
+
+// hexdump -C lines with snprintf(3).  Returns the length written.
+static size_t Reference(char *out, const uint8_t *p, size_t len,
+        size_t offset) {
+
+    char *o = out;
+    for(size_t i = 0; i < len; i += 16) {
+        o += sprintf(o, "%08zx  ", offset + i);
+        for(size_t j = 0; j < 16; ++j) {
+            if(i + j < len)
+                o += sprintf(o, "%02x ", p[i+j]);
+            else
+                o += sprintf(o, "   ");
+            if(j == 7)
+                o += sprintf(o, " ");
+        }
+        o += sprintf(o, " |");
+        for(size_t j = 0; j < 16 && i + j < len; ++j)
+            *o++ = (p[i+j] >= 0x20 && p[i+j] < 0x7F) ? p[i+j] : '.';
+        o += sprintf(o, "|\n");
+    }
+    return o - out;
+}
+
+
+static double Now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec*1.0e-9;
+}
+
+
+#define LEN  (16*1024*1024)
+
+
+int main(void) {
+
+    uint8_t *buf = malloc(LEN);
+    char *out = malloc((LEN/16 + 1)*SPEW_HEX_LINE_MAX);
+    char *ref = malloc((LEN/16 + 1)*SPEW_HEX_LINE_MAX);
+    ASSERT(buf && out && ref);
+
+    srand(1);
+    for(size_t i = 0; i < LEN; ++i)
+        buf[i] = rand();
+
+    // Check it.
+
+    size_t offsets[] = { 0, 0x10, 0xFFFFFFF0,
+#if SIZE_MAX > 0xFFFFFFFF
+        ((size_t) 1) << 40
+#endif
+    };
+    for(size_t k = 0; k < sizeof(offsets)/sizeof(offsets[0]); ++k)
+        for(size_t len = 0; len < 200; ++len) {
+            size_t n = spewHexFormat(out, buf + k, len, offsets[k]);
+            size_t r = Reference(ref, buf + k, len, offsets[k]);
+            ASSERT(n == r && memcmp(out, ref, n) == 0,
+                    "len=%zu offset=%zx\n%.*s\n%.*s", len, offsets[k],
+                    (int) n, out, (int) r, ref);
+        }
+    {
+        size_t n = spewHexFormat(out, buf, LEN, 0);
+        size_t r = Reference(ref, buf, LEN, 0);
+        ASSERT(n == r && memcmp(out, ref, n) == 0);
+    }
+
+    const char hello[] = "Hello hex dump\n\0\x01\x7f\x80\xff spew";
+    DSPEW_HEX(hello, sizeof(hello), "hello is %zu bytes", sizeof(hello));
+    DSPEW_HEX(buf, 300);
+    DSPEW_HEX(buf, 0, "nothing");
+
+    // Time it.
+
+    double t = Now();
+    char *o = out;
+    for(size_t i = 0; i < LEN; ++i)
+        o += snprintf(o, 4, "%02x ", buf[i]);
+    double printfRate = LEN/(Now() - t)/1.0e9;
+
+    t = Now();
+    for(int i = 0; i < 4; ++i)
+        spewHexFormat(out, buf, LEN, 0);
+    double formatRate = 4.0*LEN/(Now() - t)/1.0e9;
+
+    ASSERT(freopen("/dev/null", "w", stderr));
+    t = Now();
+    DSPEW_HEX(buf, LEN, "16 MiB");
+    double spewRate = LEN/(Now() - t)/1.0e9;
+
+    printf("snprintf(\"%%02x \") loop  %7.3f GB/s\n", printfRate);
+    printf("spewHexFormat()         %7.3f GB/s\n", formatRate);
+    printf("DSPEW_HEX() /dev/null   %7.3f GB/s\n", spewRate);
+
+    free(buf);
+    free(out);
+    free(ref);
+
+    return 0;
+}
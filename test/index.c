@@ -0,0 +1,99 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "../debug.h"
+
+// Writes spew from a few threads to index.log with the index in
+// index.log.idx, and checks the index.  Then try things like:
+//
+//   ../tools/spewQuery -v -l warn index.log
+//   ../tools/spewQuery -v -s index.c:33 index.log
+//   ../tools/spewQuery -v -t TID index.log
+
+
+#define NUM_THREADS  4
+#define NUM_RECORDS  20000
+
+
+static void *Run(void *arg) {
+
+    uintptr_t n = (uintptr_t) arg;
+
+    for(uint32_t i = 0; i < NUM_RECORDS; ++i) {
+        if(i % 1000 == 999)
+            WARN("thread %" PRIuPTR " record %" PRIu32, n, i);
+        else if(i % 2)
+            INFO("thread %" PRIuPTR " record %" PRIu32, n, i);
+        else
+            DSPEW("thread %" PRIuPTR " record %" PRIu32, n, i);
+    }
+    return 0;
+}
+
+
+int main(void) {
+
+    const char *logPath = "index.log";
+    const char *indexPath = "index.log.idx";
+
+    ASSERT(freopen(logPath, "w", stderr));
+    ASSERT(spewIndexOpen(stderr, indexPath, 0) == 0);
+
+    pthread_t threads[NUM_THREADS];
+    for(uintptr_t i = 0; i < NUM_THREADS; ++i)
+        CHECK(pthread_create(&threads[i], 0, Run, (void *) i));
+    for(uintptr_t i = 0; i < NUM_THREADS; ++i)
+        CHECK(pthread_join(threads[i], 0));
+
+    spewIndexClose();
+    fflush(stderr);
+
+    // Check that each index block starts at a record and that the
+    // blocks cover all the records.
+
+    FILE *log = fopen(logPath, "r");
+    ASSERT(log);
+    FILE *idx = fopen(indexPath, "r");
+    ASSERT(idx);
+
+    struct SpewIndexHeader h;
+    ASSERT(fread(&h, sizeof(h), 1, idx) == 1);
+    ASSERT(memcmp(h.magic, SPEW_INDEX_MAGIC, sizeof(h.magic)) == 0);
+    ASSERT(h.blockRecords == SPEW_INDEX_BLOCK_RECORDS);
+
+    struct SpewIndexBlock b;
+    uint64_t records = 0, end = 0;
+    size_t numBlocks = 0;
+    char line[1024];
+
+    while(fread(&b, sizeof(b), 1, idx) == 1) {
+        ASSERT(b.offset == end);
+        ASSERT(b.records && b.records <= h.blockRecords);
+        ASSERT(b.tMin <= b.tMax);
+        ASSERT(b.levels & ((1 << 2)|(1 << 4)|(1 << 5)));
+        ASSERT(fseeko(log, b.offset, SEEK_SET) == 0);
+        ASSERT(fgets(line, sizeof(line), log));
+        ASSERT(strstr(line, ":pid=") && strstr(line, ":t="), "%s", line);
+        records += b.records;
+        end = b.offset + b.length;
+        ++numBlocks;
+    }
+
+    ASSERT(fseeko(log, 0, SEEK_END) == 0);
+    ASSERT(end == ftello(log));
+    ASSERT(records == NUM_THREADS*NUM_RECORDS, "records=%" PRIu64,
+            records);
+
+    fclose(idx);
+    fclose(log);
+
+    printf("wrote %s with %zu index blocks in %s\n",
+            logPath, numBlocks, indexPath);
+
+    return 0;
+}
@@ -10,7 +10,8 @@
 
 void catcher(int sig) {
 
-    fprintf(stderr, "catch signal %d\n", sig);
+    // fprintf(3) is not async-signal-safe.
+    SAFE_ERROR("catch signal %d", sig);
     while(1)
         sleep(1);
 }
@@ -0,0 +1,146 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../debug.h"
+
+// A socketpair(2) stands in for the syslog daemon.
+
+
+static int Receive(int fd, char *buf, size_t len) {
+    ssize_t ret = recv(fd, buf, len - 1, MSG_DONTWAIT);
+    if(ret < 0) return 0;
+    buf[ret] = '\0';
+    return ret;
+}
+
+
+int main(void) {
+
+    const size_t LEN = 2048;
+    char buf[LEN];
+    int sv[2];
+
+    // RFC 3164 syslog format
+
+    ASSERT(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == 0);
+    ASSERT(spewSyslogSetFd(sv[0], SPEW_SYSLOG_RFC3164, "syslogTest") == 0);
+
+    ERROR("error %d", 1);
+    WARN("warn %d", 2);
+    INFO("info %d", 3);
+
+    ASSERT(Receive(sv[1], buf, LEN));
+    fprintf(stderr, "got: %s\n", buf);
+    ASSERT(strncmp(buf, "<11>", 4) == 0);
+    ASSERT(strstr(buf, " syslogTest["));
+    ASSERT(strstr(buf, "ERROR: ") && strstr(buf, "error 1"));
+    ASSERT(buf[strlen(buf)-1] != '\n');
+
+    ASSERT(Receive(sv[1], buf, LEN));
+    fprintf(stderr, "got: %s\n", buf);
+    ASSERT(strncmp(buf, "<12>", 4) == 0);
+
+    // INFO waits for more to send with it.
+    ASSERT(!Receive(sv[1], buf, LEN));
+    spewSyslogFlush();
+    ASSERT(Receive(sv[1], buf, LEN));
+    fprintf(stderr, "got: %s\n", buf);
+    ASSERT(strncmp(buf, "<14>", 4) == 0);
+
+    // A batch of INFO records, and a NOTICE sends them all.
+    for(int i = 0; i < 5; ++i)
+        INFO("batched %d", i);
+    ASSERT(!Receive(sv[1], buf, LEN));
+    NOTICE("notice %d", 4);
+    for(int i = 0; i < 5; ++i) {
+        ASSERT(Receive(sv[1], buf, LEN));
+        ASSERT(strstr(buf, "batched "));
+    }
+    ASSERT(Receive(sv[1], buf, LEN));
+    ASSERT(strncmp(buf, "<13>", 4) == 0);
+
+    // The fake daemon stops reading.  The socket fills and then the
+    // queue fills and then records get dropped.
+    for(int i = 0; i < 2000; ++i)
+        INFO("flood %d", i);
+
+    // The daemon catches up.  The queued records and the new ones get
+    // sent, and no more are dropped.
+    uint64_t dropped = spewSyslogDropped();
+    ASSERT(dropped > 0);
+    int n = 0;
+    while(Receive(sv[1], buf, LEN)) ++n;
+    int caughtUp = 0;
+    for(int i = 0; i < 11; ++i) {
+        if(i < 10)
+            INFO("caught up %d", i);
+        else
+            spewSyslogFlush();
+        while(Receive(sv[1], buf, LEN)) {
+            ++n;
+            if(strstr(buf, "caught up "))
+                ++caughtUp;
+        }
+    }
+    fprintf(stderr, "received %d of 2010 records\n", n);
+    ASSERT(caughtUp == 10, "caughtUp=%d", caughtUp);
+    ASSERT(spewSyslogDropped() == dropped);
+    ASSERT(n + dropped == 2010, "n=%d dropped=%" PRIu64, n, dropped);
+
+    // It stops reading again.
+    for(int i = 0; i < 2000; ++i)
+        INFO("flood %d", i);
+
+    // Closing tries to send what is still queued, and counts what it
+    // can't send as dropped.
+    spewSyslogClose();
+
+    uint64_t flooded = spewSyslogDropped() - dropped;
+    spewStats(stderr);
+    ASSERT(flooded > 0);
+
+    n = 0;
+    while(Receive(sv[1], buf, LEN)) ++n;
+    fprintf(stderr, "received %d of 2000 flood records\n", n);
+    ASSERT(n > 0 && n + flooded == 2000, "n=%d dropped=%" PRIu64,
+            n, flooded);
+
+    close(sv[1]);
+
+    // journald native format
+
+    ASSERT(socketpair(AF_UNIX, SOCK_DGRAM, 0, sv) == 0);
+    ASSERT(spewSyslogSetFd(sv[0], SPEW_SYSLOG_JOURNALD|SPEW_SYSLOG_TEE,
+                "journalTest") == 0);
+
+    NOTICE("notice\nwith a newline");
+
+    n = Receive(sv[1], buf, LEN);
+    ASSERT(n);
+    fwrite(buf, 1, n, stderr);
+    ASSERT(strncmp(buf, "PRIORITY=5\n", 11) == 0);
+    ASSERT(strstr(buf, "\nSYSLOG_IDENTIFIER=journalTest\n"));
+    ASSERT(strstr(buf, "\nCODE_FUNC=main\n"));
+    char *msg = strstr(buf, "\nMESSAGE\n");
+    ASSERT(msg);
+    msg += 9;
+    uint64_t msgLen = 0;
+    for(int i = 0; i < 8; ++i)
+        msgLen |= ((uint64_t)(uint8_t) msg[i]) << (8*i);
+    msg += 8;
+    ASSERT(msg + msgLen + 1 == buf + n);
+    ASSERT(msg[msgLen] == '\n');
+    ASSERT(strncmp(msg, "NOTICE: ", 8) == 0);
+
+    spewSyslogClose();
+    close(sv[1]);
+
+    INFO("syslog test success");
+
+    return 0;
+}
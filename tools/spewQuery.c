@@ -0,0 +1,320 @@
+// spewQuery prints the spew records in a log file that match some
+// filters.  If the log was written with spewIndexOpen() the index is
+// used to read just the blocks of the log file that may have matching
+// records.  Parts of the log file that are not in the index are read
+// and filtered line by line.
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <sys/types.h>
+
+#include "../debug.h"
+
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+"  Usage: %s [OPTIONS] LOGFILE\n"
+"\n"
+"  Print the spew records in LOGFILE that match all of the given\n"
+"  filters.\n"
+"\n"
+"    -i INDEX      use index file INDEX.  The default is LOGFILE.idx\n"
+"    -l LEVEL      records at LEVEL or more severe; error, warn, notice,\n"
+"                  info, debug or 1 to 5\n"
+"    -p PID        records from process PID\n"
+"    -t TID        records from thread TID\n"
+"    -s FILE:LINE  records from the spew call at FILE:LINE\n"
+"    -T FROM,TO    records with time stamps from seconds since the\n"
+"                  Epoch FROM to TO, either may be left out\n"
+"    -v            print how much of LOGFILE was read to stderr\n"
+"\n", argv0);
+    exit(1);
+}
+
+
+// Filters.  0 or -1 for not filtering.
+static uint32_t levels = 0;
+static int64_t pid = -1, tid = -1;
+static const char *siteFile = 0;
+static int siteLine = 0;
+static uint64_t siteBits[4];
+static int64_t tFrom = INT64_MIN, tTo = INT64_MAX;
+static bool timeFilter = false;
+
+static uint64_t bytesRead = 0;
+
+
+static int ParseLevel(const char *s) {
+    switch(*s) {
+        case 'E': case 'e': return 1;
+        case 'W': case 'w': return 2;
+        case 'N': case 'n': return 3;
+        case 'I': case 'i': return 4;
+        case 'D': case 'd': return 5;
+        default: break;
+    }
+    int l = atoi(s);
+    if(l < 1) l = 1;
+    else if(l > 5) l = 5;
+    return l;
+}
+
+
+static bool BlockMatches(const struct SpewIndexBlock *b) {
+
+    if(levels && !(b->levels & levels))
+        return false;
+    if(pid >= 0 && (pid < b->pidMin || pid > b->pidMax))
+        return false;
+    if(tid >= 0 && (tid < b->tidMin || tid > b->tidMax ||
+                !(b->tidBits & spewIndexTidBit(tid))))
+        return false;
+    if(siteFile)
+        for(int i = 0; i < 4; ++i)
+            if((b->siteBits[i] & siteBits[i]) != siteBits[i])
+                return false;
+    if(timeFilter && (b->tMax < tFrom || b->tMin > tTo))
+        return false;
+    return true;
+}
+
+
+// Returns true if line starts a spew record, and if so says if it
+// matches the filters in *matches.
+//
+// A record line looks like:
+//
+//   PRE FILE:LINE:pid=PID:TID[:t=SEC.USEC] FUNC(): ...
+//
+static bool ParseRecord(const char *line, bool *matches) {
+
+    const char *p = strstr(line, ":pid=");
+    if(!p) return false;
+
+    // Back over LINE and FILE.
+    const char *q = p;
+    while(q > line && q[-1] >= '0' && q[-1] <= '9') --q;
+    if(q == p || q == line || q[-1] != ':') return false;
+    int lineNum = atoi(q);
+    const char *fileEnd = q - 1;
+    const char *file = fileEnd;
+    while(file > line && file[-1] != ' ') --file;
+    if(file == line) return false;
+
+    unsigned int rpid;
+    size_t rtid;
+    int n = 0;
+    if(sscanf(p, ":pid=%u:%zu%n", &rpid, &rtid, &n) != 2)
+        return false;
+    p += n;
+
+    bool haveTime = false;
+    int64_t usec = 0;
+    if(strncmp(p, ":t=", 3) == 0) {
+        char *end;
+        int64_t sec = strtoll(p + 3, &end, 10);
+        if(*end == '.')
+            usec = sec*1000000 + strtoll(end + 1, 0, 10);
+        haveTime = true;
+    }
+
+    *matches = false;
+
+    if(levels) {
+        // The PRE ends with one of these, else it's an ASSERT() that
+        // spews at level 1.
+        static const char *names[] = {
+            0, "ERROR:", "WARN:", "NOTICE:", "INFO:", "DEBUG:" };
+        size_t preLen = file - 1 - line;
+        int level = 1;
+        for(int i = 1; i <= 5; ++i) {
+            size_t l = strlen(names[i]);
+            if(preLen >= l &&
+                    strncmp(line + preLen - l, names[i], l) == 0) {
+                level = i;
+                break;
+            }
+        }
+        if(!(levels & (1 << level)))
+            return true;
+    }
+    if(pid >= 0 && rpid != pid)
+        return true;
+    if(tid >= 0 && rtid != tid)
+        return true;
+    if(siteFile && (lineNum != siteLine ||
+                strlen(siteFile) != (size_t) (fileEnd - file) ||
+                strncmp(siteFile, file, fileEnd - file)))
+        return true;
+    if(timeFilter && (!haveTime || usec < tFrom || usec > tTo))
+        return true;
+
+    *matches = true;
+    return true;
+}
+
+
+// Print the matching records in log file bytes [from, to).  to < 0 is
+// to the end of the file.
+static void Scan(FILE *f, off_t from, off_t to) {
+
+    static char *line = 0;
+    static size_t size = 0;
+    // Continuation lines go with the record before them.
+    bool matches = false;
+
+    ASSERT(fseeko(f, from, SEEK_SET) == 0);
+
+    while(to < 0 || from < to) {
+        ssize_t n = getline(&line, &size, f);
+        if(n <= 0) break;
+        from += n;
+        bytesRead += n;
+        ParseRecord(line, &matches);
+        if(matches)
+            fwrite(line, 1, n, stdout);
+    }
+}
+
+
+static struct SpewIndexBlock *ReadIndex(const char *path, size_t *num) {
+
+    FILE *f = fopen(path, "r");
+    if(!f) return 0;
+
+    struct SpewIndexHeader h;
+    if(fread(&h, sizeof(h), 1, f) != 1 ||
+            memcmp(h.magic, SPEW_INDEX_MAGIC, sizeof(h.magic)) ||
+            h.blockSize != sizeof(struct SpewIndexBlock)) {
+        ERROR("\"%s\" is not a spew index file", path);
+        fclose(f);
+        return 0;
+    }
+
+    size_t n = 0, alloc = 0;
+    struct SpewIndexBlock *blocks = 0;
+    while(true) {
+        if(n == alloc) {
+            alloc = alloc ? 2*alloc : 1024;
+            blocks = realloc(blocks, alloc*sizeof(*blocks));
+            ASSERT(blocks, "realloc() failed");
+        }
+        if(fread(&blocks[n], sizeof(*blocks), 1, f) != 1)
+            break;
+        ++n;
+    }
+    fclose(f);
+    *num = n;
+    return blocks;
+}
+
+
+int main(int argc, char **argv) {
+
+    const char *indexPath = 0;
+    bool verbose = false;
+    int c;
+
+    while((c = getopt(argc, argv, "i:l:p:t:s:T:vh")) != -1) {
+        switch(c) {
+            case 'i':
+                indexPath = optarg;
+                break;
+            case 'l':
+                // Bits 1 to level.
+                levels = ((1 << (ParseLevel(optarg) + 1)) - 1) & ~1;
+                break;
+            case 'p':
+                pid = strtoll(optarg, 0, 10);
+                break;
+            case 't':
+                tid = strtoll(optarg, 0, 10);
+                break;
+            case 's':
+            {
+                char *colon = strrchr(optarg, ':');
+                if(!colon) usage(argv[0]);
+                *colon = '\0';
+                siteFile = optarg;
+                siteLine = atoi(colon + 1);
+                spewIndexSiteBits(spewIndexSiteHash(siteFile, siteLine),
+                        siteBits);
+                break;
+            }
+            case 'T':
+            {
+                char *comma = strchr(optarg, ',');
+                if(comma) *comma = '\0';
+                if(*optarg)
+                    tFrom = (int64_t) (strtod(optarg, 0)*1000000);
+                if(comma && comma[1])
+                    tTo = (int64_t) (strtod(comma + 1, 0)*1000000);
+                timeFilter = true;
+                break;
+            }
+            case 'v':
+                verbose = true;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(optind != argc - 1)
+        usage(argv[0]);
+
+    const char *logPath = argv[optind];
+    char *defaultIndexPath = 0;
+    if(!indexPath) {
+        ASSERT(asprintf(&defaultIndexPath, "%s.idx", logPath) > 0);
+        indexPath = defaultIndexPath;
+    }
+
+    FILE *f = fopen(logPath, "r");
+    if(!f) {
+        ERROR("fopen(\"%s\", \"r\") failed", logPath);
+        return 1;
+    }
+    ASSERT(fseeko(f, 0, SEEK_END) == 0);
+    off_t fileSize = ftello(f);
+
+    size_t numBlocks = 0, blocksRead = 0;
+    struct SpewIndexBlock *blocks = ReadIndex(indexPath, &numBlocks);
+
+    // Read what is not in index blocks, and the index blocks that may
+    // have matching records.
+    off_t pos = 0;
+    for(size_t i = 0; i < numBlocks; ++i) {
+        struct SpewIndexBlock *b = &blocks[i];
+        if(b->offset < pos || b->offset + b->length > fileSize)
+            // We did not expect that.  The log file must have been
+            // written over.  Just read the rest.
+            break;
+        if(b->offset > pos)
+            Scan(f, pos, b->offset);
+        if(BlockMatches(b)) {
+            Scan(f, b->offset, b->offset + b->length);
+            ++blocksRead;
+        }
+        pos = b->offset + b->length;
+    }
+    Scan(f, pos, -1);
+
+    if(verbose)
+        fprintf(stderr, "read %" PRIu64 " of %jd bytes (%.2f%%) using "
+                "%zu of %zu index blocks\n",
+                bytesRead, (intmax_t) fileSize,
+                fileSize ? 100.0*bytesRead/fileSize : 0.0,
+                blocksRead, numBlocks);
+
+    fclose(f);
+    free(blocks);
+    free(defaultIndexPath);
+
+    return 0;
+}